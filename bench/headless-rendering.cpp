@@ -0,0 +1,111 @@
+#include "engine/rendering/render-context.hpp"
+#include "engine/rendering/render-target.hpp"
+#include "engine/rendering/shader.hpp"
+#include "engine/rendering/vertex-array.hpp"
+
+#include "engine/core/array-list.hpp"
+#include "engine/core/memory.hpp"
+
+namespace {
+	// only uploaded to from the main thread
+	ArrayList<uint8> uploadBuffer;
+
+	void copy_upload(const void* data, uintptr dataSize) {
+		if (data == nullptr) {
+			return;
+		}
+
+		if (uploadBuffer.size() < dataSize) {
+			uploadBuffer.resize(dataSize);
+		}
+
+		Memory::memcpy(uploadBuffer.data(), data, dataSize);
+	}
+};
+
+// Stands in for render-context.cpp and vertex-array.cpp in the bench build so
+// the voxel code links without a GL context. Buffers only track their sizes,
+// which is all the chunk upload path reads back, uploads are copied to a
+// scratch buffer so they cost time in proportion to their size. Render
+// targets and shaders
+// are never bound, the bench only needs to construct them for
+// ChunkManager::render_chunks().
+
+RenderContext::RenderContext()
+		: screenQuad(nullptr)
+		, version(0)
+		, shaderVersion("")
+		, viewportWidth(0)
+		, viewportHeight(0)
+		, currentSourceBlend(BLEND_FUNC_NONE)
+		, currentDestBlend(BLEND_FUNC_NONE)
+		, polygonMode(POLYGON_MODE_FILL)
+		, currentShader(0)
+		, currentVertexArray(0)
+		, currentTFB(0)
+		, currentRenderSource(0)
+		, currentRenderTarget(0) {}
+
+void RenderContext::draw(RenderTarget&, Shader&, VertexArray&, uint32, uint32) {}
+
+RenderContext::~RenderContext() {}
+
+RenderTarget::~RenderTarget() {}
+
+Shader::~Shader() {}
+
+VertexArray::VertexArray(RenderContext& context,
+			const IndexedModel& model, uint32 usage)
+		: context(&context)
+		, arrayID(0)
+		, numBuffers(model.getNumVertexComponents()
+				+ model.getNumInstanceComponents() + 1)
+		, numElements(model.getNumIndices())
+		, instancedComponentStartIndex(model.getInstancedElementStartIndex())
+		, numOwnedBuffers(numBuffers)
+		, buffers(new GLuint[numBuffers]())
+		, bufferSizes(new uintptr[numBuffers]())
+		, usage(usage)
+		, indexed(true)
+		, bufferOwnership(FULLY_OWNED) {
+	bufferSizes[numBuffers - 1] = numElements * sizeof(uint32);
+}
+
+VertexArray::VertexArray(RenderContext& context,
+			const IndexedModel& model, uint32 usage, VertexArray& indexSource)
+		: context(&context)
+		, arrayID(0)
+		, numBuffers(model.getNumVertexComponents()
+				+ model.getNumInstanceComponents() + 1)
+		, numElements(indexSource.numElements)
+		, instancedComponentStartIndex(model.getInstancedElementStartIndex())
+		, numOwnedBuffers(numBuffers - 1)
+		, buffers(new GLuint[numBuffers]())
+		, bufferSizes(new uintptr[numBuffers]())
+		, usage(usage)
+		, indexed(true)
+		, bufferOwnership(SHARED_INDEX_BUFFER) {
+	bufferSizes[numBuffers - 1] = indexSource.bufferSizes[indexSource.numBuffers - 1];
+}
+
+void VertexArray::updateBuffer(uint32 bufferIndex, const void* data, uintptr dataSize) {
+	copy_upload(data, dataSize);
+
+	if (dataSize > bufferSizes[bufferIndex]) {
+		bufferSizes[bufferIndex] = dataSize;
+	}
+}
+
+void VertexArray::updateBufferRange(uint32, const void* data, uintptr, uintptr dataSize) {
+	copy_upload(data, dataSize);
+}
+
+void VertexArray::updateIndices(const uint32*, uint32 numIndices) {
+	numElements = numIndices;
+	bufferSizes[numBuffers - 1] = numIndices * sizeof(uint32);
+}
+
+VertexArray::~VertexArray() {
+	delete[] buffers;
+	delete[] bufferSizes;
+}
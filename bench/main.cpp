@@ -0,0 +1,1239 @@
+#include <engine/core/common.hpp>
+#include <engine/core/array-list.hpp>
+#include <engine/core/time.hpp>
+
+#include <engine/math/math.hpp>
+#include <engine/math/matrix.hpp>
+
+#include <engine/rendering/render-context.hpp>
+#include <engine/rendering/render-target.hpp>
+#include <engine/rendering/shader.hpp>
+
+#include "block-registry.hpp"
+#include "block-storage.hpp"
+#include "chunk.hpp"
+#include "chunk-builder.hpp"
+#include "chunk-manager.hpp"
+#include "camera.hpp"
+#include "job-system.hpp"
+#include "region-store.hpp"
+#include "terrain-generator.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdlib>
+#include <ctime>
+#include <filesystem>
+#include <random>
+#include <thread>
+
+#ifdef OPERATING_SYSTEM_LINUX
+    #include <fcntl.h>
+    #include <unistd.h>
+#endif
+
+// Headless benchmarks for the voxel code, built with `make bench` once per
+// chunk size and block layout. Every workload is deterministic, results are
+// printed one JSON object per line:
+//     {"bench":"mesh_binary","chunk_size":16,"layout":"linear",...}
+// Latencies are per op in microseconds. Mesh hashes change only when the
+// generated geometry does, so both layouts of one size print the same ones.
+// Workloads cover the same blocks at every chunk size, so ops are chunks and
+// a larger size does fewer, larger ones.
+
+namespace {
+#ifdef VOXEL_MORTON_BLOCKS
+    constexpr const char* BLOCK_LAYOUT = "morton";
+#else
+    constexpr const char* BLOCK_LAYOUT = "linear";
+#endif
+
+    // in blocks, 16 chunks at CHUNK_SIZE 16
+    constexpr const int32 DEFAULT_VIEW_DISTANCE = 256;
+
+    // fixed block region covering air, surface and solid chunks
+    constexpr const int32 SET_HALF_WIDTH = 128 / Chunk::CHUNK_SIZE;
+    constexpr const int32 SET_MIN_Y = -64 / Chunk::CHUNK_SIZE;
+    constexpr const int32 SET_MAX_Y = 64 / Chunk::CHUNK_SIZE;
+
+    // one chunk per step at CHUNK_SIZE 16, larger chunks cross a border
+    // only every few steps
+    constexpr const int32 NUM_FLYTHROUGH_STEPS = 16;
+    constexpr const float FLYTHROUGH_STEP = 16.f;
+    constexpr const float FLYTHROUGH_HEIGHT = 16.f;
+    constexpr const double FRAME_TIME = 1.0 / 240.0;
+    constexpr const double STREAM_TIMEOUT = 120.0;
+
+    constexpr const int32 NUM_RAYS = 10000;
+    constexpr const uint32 RAY_SEED = 1337;
+
+    // block accesses are timed in batches, a single one is below the
+    // resolution of the timer
+    constexpr const int32 NUM_BLOCK_BATCHES = 1000;
+    constexpr const int32 BLOCK_BATCH_SIZE = 4096;
+    constexpr const uint32 BLOCK_SEED = 4242;
+
+    // edits per chunk before it is saved to a region file, few enough to be
+    // saved as a delta over the terrain and enough to save the whole chunk
+    constexpr const int32 NUM_SPARSE_EDITS = 16;
+    constexpr const int32 NUM_DENSE_EDITS = 2 * Chunk::MAX_EDITS;
+
+    // blocks placed and removed per frame within EDIT_RADIUS of the camera
+    // while chunks are drawn, enough to keep the rebuild workers busy
+    constexpr const int32 NUM_EDIT_FRAMES = 480;
+    constexpr const int32 EDITS_PER_FRAME = 64;
+    constexpr const int32 EDIT_RADIUS = 24;
+    constexpr const uint32 EDIT_SEED = 2024;
+
+    // frames run with every chunk loaded and meshed, the workers should
+    // take no CPU time then
+    constexpr const double IDLE_TIME = 2.0;
+
+    // jobs submitted one at a time to a pool whose worker has gone to
+    // sleep, WAKE_INTERVAL apart
+    constexpr const int32 NUM_WAKE_JOBS = 1000;
+    constexpr const double WAKE_INTERVAL = 0.001;
+
+    // jumps along +x far enough that every chunk in range loads again,
+    // with the camera looking ahead and a scene's projection
+    constexpr const int32 NUM_TELEPORTS = 4;
+    constexpr const float TELEPORT_DISTANCE = 4096.f;
+    constexpr const float FIELD_OF_VIEW = 70.f;
+    constexpr const float ASPECT_RATIO = 4.f / 3.f;
+    constexpr const float Z_NEAR = 0.1f;
+    constexpr const float Z_FAR = 1000.f;
+
+    // a camera crossing FAST_STEP blocks every frame, faster than the
+    // workers keep up with, so chunks move on before their jobs run
+    constexpr const int32 NUM_FAST_FRAMES = 240;
+    constexpr const float FAST_STEP = 32.f;
+
+    // teleports timed with uploads capped at these per frame and without
+    // a cap, the byte budget is low enough to bind on this terrain
+    constexpr const int32 NUM_BUDGET_TELEPORTS = 2;
+    constexpr const size_t UPLOAD_BUDGET_BYTES = 4096;
+    constexpr const double UPLOAD_BUDGET_TIME = 0.001;
+
+    // the initial load is timed with 1 worker up to this many or one per
+    // core, whichever is more
+    constexpr const uint32 MIN_SCALING_WORKERS = 4;
+
+    // block types registered for the type count workloads, capped by the
+    // vertex layout, and how many of them the solid blocks of one chunk mix
+    constexpr const uint32 NUM_REGISTERED_TYPES = 4096;
+    constexpr const uint32 FEW_CHUNK_TYPES = 3;
+    constexpr const uint32 MANY_CHUNK_TYPES = 48;
+
+    class Samples {
+        public:
+            // a batch of numOps counts as numOps ops of equal latency
+            void add(double seconds, size_t numOps = 1) {
+                samples.push_back(seconds * 1.0e6 / numOps);
+                total += seconds;
+                this->numOps += numOps;
+            }
+
+            void report(const char* name, const char* extra = "") {
+                std::sort(std::begin(samples), std::end(samples));
+
+                const double opsPerSec = total > 0.0 ? numOps / total : 0.0;
+
+                printf("{\"bench\":\"%s\",\"chunk_size\":%d,\"layout\":\"%s\","
+                        "\"ops\":%zu,\"total_s\":%.6f,\"ops_per_sec\":%.1f,"
+                        "\"p50_us\":%.3f,\"p90_us\":%.3f,\"p99_us\":%.3f,"
+                        "\"max_us\":%.3f%s}\n", name, Chunk::CHUNK_SIZE,
+                        BLOCK_LAYOUT, numOps, total, opsPerSec,
+                        percentile(0.5), percentile(0.9), percentile(0.99),
+                        samples.empty() ? 0.0 : samples.back(), extra);
+                fflush(stdout);
+            }
+
+            size_t get_num_ops() const {
+                return numOps;
+            }
+        private:
+            ArrayList<double> samples;
+            double total = 0.0;
+            size_t numOps = 0;
+
+            double percentile(double p) const {
+                if (samples.empty()) {
+                    return 0.0;
+                }
+
+                // nearest rank
+                const size_t rank = static_cast<size_t>(p * samples.size() + 0.5);
+                return samples[rank > 0 ? std::min(rank, samples.size()) - 1 : 0];
+            }
+    };
+
+    size_t get_resident_bytes() {
+#ifdef OPERATING_SYSTEM_LINUX
+        FILE* file = fopen("/proc/self/statm", "r");
+        long numPages = 0;
+
+        if (file) {
+            if (fscanf(file, "%*s %ld", &numPages) != 1) {
+                numPages = 0;
+            }
+
+            fclose(file);
+        }
+
+        return static_cast<size_t>(numPages) * sysconf(_SC_PAGESIZE);
+#else
+        return 0;
+#endif
+    }
+
+    // CPU time of every thread of the process
+    double get_cpu_seconds() {
+        return static_cast<double>(std::clock()) / CLOCKS_PER_SEC;
+    }
+
+    uint64 hash_vertices(uint64 hash, const ArrayList<ChunkVertex>& vertices) {
+        for (const ChunkVertex& v : vertices) {
+            hash = (hash ^ v.packed) * 1099511628211ull;
+            hash = (hash ^ v.type) * 1099511628211ull;
+        }
+
+        return hash;
+    }
+
+    template <typename Func>
+    void for_each_set_chunk(Func&& func) {
+        for (int32 y = SET_MIN_Y; y < SET_MAX_Y; ++y) {
+            for (int32 z = -SET_HALF_WIDTH; z < SET_HALF_WIDTH; ++z) {
+                for (int32 x = -SET_HALF_WIDTH; x < SET_HALF_WIDTH; ++x) {
+                    func(Vector3i(x, y, z));
+                }
+            }
+        }
+    }
+
+    void bench_terrain(Chunk& chunk, TerrainGenerator& generator) {
+        Samples samples;
+
+        for_each_set_chunk([&](const Vector3i& pos) {
+            chunk.moveTo(pos);
+
+            const double start = Time::getTime();
+            chunk.load(pos, chunk.getGeneration(), generator);
+            samples.add(Time::getTime() - start);
+        });
+
+        samples.report("terrain");
+    }
+
+    // returns the number of quads meshed
+    uint64 bench_mesher(const char* name, MesherType type, Chunk& chunk,
+            TerrainGenerator& generator) {
+        const ChunkBorders borders = {};
+        ChunkBuilder chunkBuilder;
+        bool refined;
+
+        Samples samples;
+        uint64 hash = 14695981039346656037ull;
+        uint64 numQuads = 0;
+
+        for_each_set_chunk([&](const Vector3i& pos) {
+            chunk.moveTo(pos);
+            chunk.load(pos, chunk.getGeneration(), generator);
+
+            const double start = Time::getTime();
+            chunk.rebuild(chunkBuilder, borders, chunk.getGeneration(),
+                    refined, type);
+            samples.add(Time::getTime() - start);
+
+            hash = hash_vertices(hash, chunkBuilder.get_vertices());
+            numQuads += chunkBuilder.num_quads();
+
+            chunkBuilder.clear();
+        });
+
+        char extra[128];
+        snprintf(extra, sizeof(extra), ",\"quads\":%llu,\"hash\":\"%016llx\"",
+                static_cast<unsigned long long>(numQuads),
+                static_cast<unsigned long long>(hash));
+
+        samples.report(name, extra);
+
+        return numQuads;
+    }
+
+    // registers types up to what the vertex layout holds, then meshes the
+    // set with the solid blocks of every chunk spread over numChunkTypes of
+    // them, picked from across the whole registry. Each type takes a
+    // contiguous band of the chunk, so few types merge like plain terrain,
+    // whose quad count is given by plainQuads. The registry cannot drop
+    // types again, so this runs after every other bench
+    void bench_mesher_types(Chunk& chunk, TerrainGenerator& generator,
+            uint32 numChunkTypes, uint64 plainQuads) {
+        auto& registry = BlockRegistry::getInstance();
+        const uint32 numTypes = std::min(NUM_REGISTERED_TYPES,
+                ChunkBuilder::get_max_block_types());
+
+        if (registry.get_num_types() < numTypes) {
+            const auto fileName = std::filesystem::temp_directory_path()
+                    / "voxel-bench-blocks.txt";
+            FILE* file = fopen(fileName.string().c_str(), "w");
+
+            // the built in types come first, the file adds the rest
+            const uint32 numAddedTypes = numTypes
+                    - static_cast<uint32>(BlockType::NUM_BUILTIN_TYPES);
+
+            for (uint32 i = 0; file && i < numAddedTypes; ++i) {
+                fprintf(file, "type%u %u %u %u 1.0 1 0.0 cube\n", i,
+                        i & 255, (i >> 4) & 255, (i >> 8) & 255);
+            }
+
+            if (file) {
+                fclose(file);
+            }
+
+            registry.load(fileName.string(), numTypes);
+        }
+
+        const uint32 numAddedTypes = registry.get_num_types()
+                - static_cast<uint32>(BlockType::NUM_BUILTIN_TYPES);
+        const uint32 typeStride = std::max(numAddedTypes / numChunkTypes, 1u);
+
+        const ChunkBorders borders = {};
+        ChunkBuilder chunkBuilder;
+        bool refined;
+
+        Samples samples;
+        uint64 numQuads = 0;
+
+        for_each_set_chunk([&](const Vector3i& pos) {
+            chunk.moveTo(pos);
+            chunk.load(pos, chunk.getGeneration(), generator);
+
+            for (int32 x = 0; x < Chunk::CHUNK_SIZE; ++x) {
+                for (int32 y = 0; y < Chunk::CHUNK_SIZE; ++y) {
+                    for (int32 z = 0; z < Chunk::CHUNK_SIZE; ++z) {
+                        if (!chunk.get(x, y, z)) {
+                            continue;
+                        }
+
+                        // bands run along z and split the x, y plane
+                        const uint32 slot = static_cast<uint32>(
+                                y * Chunk::CHUNK_SIZE + x) * numChunkTypes
+                                / (Chunk::CHUNK_SIZE * Chunk::CHUNK_SIZE);
+                        const uint32 type = static_cast<uint32>(
+                                BlockType::NUM_BUILTIN_TYPES)
+                                + (slot * typeStride) % numAddedTypes;
+
+                        chunk.setBlock(Vector3i(x, y, z), true,
+                                static_cast<BlockType>(type));
+                    }
+                }
+            }
+
+            const double start = Time::getTime();
+            chunk.rebuild(chunkBuilder, borders, chunk.getGeneration(),
+                    refined, MesherType::BINARY);
+            samples.add(Time::getTime() - start);
+
+            numQuads += chunkBuilder.num_quads();
+
+            chunkBuilder.clear();
+        });
+
+        char extra[128];
+        snprintf(extra, sizeof(extra), ",\"registered_types\":%u,"
+                "\"chunk_types\":%u,\"quads\":%llu,\"plain_quads\":%llu",
+                registry.get_num_types(), numChunkTypes,
+                static_cast<unsigned long long>(numQuads),
+                static_cast<unsigned long long>(plainQuads));
+
+        samples.report("mesh_binary_types", extra);
+    }
+
+    // every set chunk with blocks of its own, read through Chunk::get() and
+    // meshed once expanded and once compressed
+    void bench_block_compression(Chunk& chunk, TerrainGenerator& generator) {
+        const ChunkBorders borders = {};
+        ChunkBuilder chunkBuilder;
+        bool refined;
+
+        std::mt19937 rng(BLOCK_SEED);
+        ArrayList<Vector3i> positions(BLOCK_BATCH_SIZE);
+
+        for (Vector3i& position : positions) {
+            position = Vector3i(rng() % Chunk::CHUNK_SIZE,
+                    rng() % Chunk::CHUNK_SIZE, rng() % Chunk::CHUNK_SIZE);
+        }
+
+        Samples expandedGets, compressedGets;
+        Samples expandedMeshes, compressedMeshes;
+        Samples compressions;
+
+        size_t expandedBytes = 0;
+        size_t compressedBytes = 0;
+        uint32 numChunks = 0;
+        uint32 checksum = 0;
+
+        const auto readBlocks = [&](Samples& samples) {
+            const double start = Time::getTime();
+
+            for (const Vector3i& position : positions) {
+                checksum += chunk.get(position).is_active();
+            }
+
+            samples.add(Time::getTime() - start, BLOCK_BATCH_SIZE);
+        };
+
+        const auto meshBlocks = [&](Samples& samples) {
+            const double start = Time::getTime();
+            chunk.rebuild(chunkBuilder, borders, chunk.getGeneration(),
+                    refined, MesherType::BINARY);
+            samples.add(Time::getTime() - start);
+
+            chunkBuilder.clear();
+        };
+
+        for_each_set_chunk([&](const Vector3i& pos) {
+            chunk.moveTo(pos);
+            chunk.load(pos, chunk.getGeneration(), generator);
+
+            const size_t chunkBytes = chunk.getBlockMemory();
+
+            if (chunkBytes == 0) {
+                return;
+            }
+
+            readBlocks(expandedGets);
+            meshBlocks(expandedMeshes);
+
+            // loaded again so the mesh is built from scratch once more
+            chunk.moveTo(pos);
+            chunk.load(pos, chunk.getGeneration(), generator);
+            chunk.setCompressed(true);
+
+            const double start = Time::getTime();
+            chunk.updateCompression();
+            compressions.add(Time::getTime() - start);
+
+            readBlocks(compressedGets);
+            meshBlocks(compressedMeshes);
+
+            expandedBytes += chunkBytes;
+            compressedBytes += chunk.getBlockMemory();
+            ++numChunks;
+
+            chunk.setCompressed(false);
+        });
+
+        printf("{\"bench\":\"block_compression\",\"chunk_size\":%d,"
+                "\"layout\":\"%s\",\"chunks\":%u,"
+                "\"expanded_bytes_per_chunk\":%.1f,"
+                "\"compressed_bytes_per_chunk\":%.1f}\n", Chunk::CHUNK_SIZE,
+                BLOCK_LAYOUT, numChunks,
+                static_cast<double>(expandedBytes) / std::max(numChunks, 1u),
+                static_cast<double>(compressedBytes) / std::max(numChunks, 1u));
+
+        char extra[64];
+        snprintf(extra, sizeof(extra), ",\"checksum\":%u", checksum);
+
+        compressions.report("block_compress");
+        expandedGets.report("block_get_expanded", extra);
+        compressedGets.report("block_get_compressed", extra);
+        expandedMeshes.report("mesh_expanded");
+        compressedMeshes.report("mesh_compressed");
+    }
+
+    void bench_block_storage(Chunk& chunk, TerrainGenerator& generator) {
+        size_t numBytes = 0;
+        uint32 numChunks = 0;
+
+        size_t maxBytes = 0;
+        Vector3i widestChunk;
+
+        for_each_set_chunk([&](const Vector3i& pos) {
+            chunk.moveTo(pos);
+            chunk.load(pos, chunk.getGeneration(), generator);
+
+            const size_t chunkBytes = chunk.getBlockMemory();
+
+            if (chunkBytes > maxBytes) {
+                maxBytes = chunkBytes;
+                widestChunk = pos;
+            }
+
+            numBytes += chunkBytes;
+            ++numChunks;
+        });
+
+        printf("{\"bench\":\"block_memory\",\"chunk_size\":%d,"
+                "\"layout\":\"%s\",\"chunks\":%u,"
+                "\"palette_bytes_per_chunk\":%.1f,"
+                "\"dense_bytes_per_chunk\":%zu}\n", Chunk::CHUNK_SIZE,
+                BLOCK_LAYOUT, numChunks, static_cast<double>(numBytes) / numChunks,
+                Chunk::NUM_BLOCKS * sizeof(Block));
+
+        // the chunk with the widest indices, in palette storage and in the
+        // flat array chunks used before
+        chunk.moveTo(widestChunk);
+        chunk.load(widestChunk, chunk.getGeneration(), generator);
+
+        BlockStorage storage(Chunk::NUM_BLOCKS);
+        ArrayList<Block> dense(Chunk::NUM_BLOCKS);
+        ArrayList<Block> types;
+
+        for (int32 x = 0, i = 0; x < Chunk::CHUNK_SIZE; ++x) {
+            for (int32 y = 0; y < Chunk::CHUNK_SIZE; ++y) {
+                for (int32 z = 0; z < Chunk::CHUNK_SIZE; ++z, ++i) {
+                    const Block block = chunk.get(x, y, z);
+
+                    storage.set(i, block);
+                    dense[i] = block;
+
+                    if (std::find(std::begin(types), std::end(types), block)
+                            == std::end(types)) {
+                        types.push_back(block);
+                    }
+                }
+            }
+        }
+
+        storage.repack();
+
+        std::mt19937 rng(BLOCK_SEED);
+        ArrayList<uint32> indices(BLOCK_BATCH_SIZE);
+        ArrayList<Block> values(BLOCK_BATCH_SIZE);
+
+        for (int32 i = 0; i < BLOCK_BATCH_SIZE; ++i) {
+            indices[i] = rng() % Chunk::NUM_BLOCKS;
+            values[i] = types[rng() % types.size()];
+        }
+
+        Samples paletteGets, denseGets, paletteSets, denseSets;
+        uint32 checksum = 0;
+
+        for (int32 batch = 0; batch < NUM_BLOCK_BATCHES; ++batch) {
+            double start = Time::getTime();
+
+            for (uint32 index : indices) {
+                checksum += storage.get(index).is_active();
+            }
+
+            paletteGets.add(Time::getTime() - start, BLOCK_BATCH_SIZE);
+
+            start = Time::getTime();
+
+            for (uint32 index : indices) {
+                checksum += dense[index].is_active();
+            }
+
+            denseGets.add(Time::getTime() - start, BLOCK_BATCH_SIZE);
+
+            start = Time::getTime();
+
+            for (int32 i = 0; i < BLOCK_BATCH_SIZE; ++i) {
+                storage.set(indices[i], values[i]);
+            }
+
+            paletteSets.add(Time::getTime() - start, BLOCK_BATCH_SIZE);
+
+            start = Time::getTime();
+
+            for (int32 i = 0; i < BLOCK_BATCH_SIZE; ++i) {
+                dense[indices[i]] = values[i];
+            }
+
+            denseSets.add(Time::getTime() - start, BLOCK_BATCH_SIZE);
+        }
+
+        char extra[128];
+        snprintf(extra, sizeof(extra), ",\"bits_per_block\":%u,"
+                "\"checksum\":%u", storage.get_bits_per_block(), checksum);
+
+        paletteGets.report("block_get_palette", extra);
+        denseGets.report("block_get_dense", extra);
+        paletteSets.report("block_set_palette", extra);
+        denseSets.report("block_set_dense", extra);
+    }
+
+    // under the temp directory, one per chunk size and layout so several
+    // configs can run at once
+    String get_save_directory() {
+        char name[64];
+        snprintf(name, sizeof(name), "voxel-bench-%d-%s", Chunk::CHUNK_SIZE,
+                BLOCK_LAYOUT);
+
+        return (std::filesystem::temp_directory_path() / name).string();
+    }
+
+    // drops the region files from the page cache, so the next reads go to
+    // the disk. Only possible on Linux, elsewhere cold loads are warm ones.
+    void evict_region_files(const String& directory) {
+#ifdef OPERATING_SYSTEM_LINUX
+        for (const auto& entry
+                : std::filesystem::directory_iterator(directory.c_str())) {
+            const int fd = open(entry.path().c_str(), O_RDONLY);
+
+            if (fd >= 0) {
+                fdatasync(fd);
+                posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+                close(fd);
+            }
+        }
+#endif
+    }
+
+    template <typename Func>
+    void load_saved_chunks(RegionStore& regionStore, Chunk& chunk,
+            TerrainGenerator& generator, Samples& samples, Func&& func) {
+        uint32 numFailed = 0;
+
+        for_each_set_chunk([&](const Vector3i& pos) {
+            chunk.moveTo(pos);
+
+            const double start = Time::getTime();
+
+            if (!regionStore.load_chunk(pos, [&](const uint8* data,
+                    size_t size) {
+                return chunk.load(pos, chunk.getGeneration(), data, size,
+                        generator);
+            })) {
+                ++numFailed;
+            }
+
+            samples.add(Time::getTime() - start);
+        });
+
+        func(numFailed);
+    }
+
+    // bytes save() would write for the whole block storage of a chunk
+    size_t get_full_save_size(const Chunk& chunk) {
+        BlockStorage storage(Chunk::NUM_BLOCKS);
+        ArrayList<uint8> data;
+
+        for (int32 x = 0, i = 0; x < Chunk::CHUNK_SIZE; ++x) {
+            for (int32 y = 0; y < Chunk::CHUNK_SIZE; ++y) {
+                for (int32 z = 0; z < Chunk::CHUNK_SIZE; ++z, ++i) {
+                    storage.set(i, chunk.get(x, y, z));
+                }
+            }
+        }
+
+        storage.repack();
+        storage.write(data);
+
+        return data.size() + 1;
+    }
+
+    // makes numEdits edits to every chunk of the set, saves it to region
+    // files and loads it back through fresh stores, so reads go to the
+    // files rather than the write queue. Sparse edits are saved as a delta
+    // and loaded by generating the terrain and applying them, dense ones
+    // save the whole chunk. Compare the loads against terrain, which
+    // regenerates the same chunks:
+    //     region_load_cold        page cache dropped first
+    //     region_load_prefetched  page cache dropped, then every chunk
+    //                             prefetched before the loads
+    //     region_load_warm        the same files read a second time
+    void bench_region_store(Chunk& chunk, TerrainGenerator& generator,
+            int32 numEdits) {
+        const String directory = get_save_directory();
+        std::filesystem::remove_all(directory.c_str());
+
+        std::mt19937 rng(BLOCK_SEED);
+        ArrayList<uint8> data;
+        ArrayList<Vector3i> positions;
+        size_t numBytes = 0;
+        size_t numFullBytes = 0;
+
+        Samples saves;
+        double flushTime;
+
+        {
+            RegionStore regionStore(directory);
+
+            for_each_set_chunk([&](const Vector3i& pos) {
+                chunk.moveTo(pos);
+                chunk.load(pos, chunk.getGeneration(), generator);
+
+                for (int32 i = 0; i < numEdits; ++i) {
+                    const Vector3i blockPos(rng() % Chunk::CHUNK_SIZE,
+                            rng() % Chunk::CHUNK_SIZE,
+                            rng() % Chunk::CHUNK_SIZE);
+                    const bool active = rng() & 1;
+
+                    chunk.setBlock(blockPos, active,
+                            active ? BlockType::STONE : BlockType::AIR);
+                }
+
+                const double start = Time::getTime();
+                chunk.save(data);
+                numBytes += data.size();
+                regionStore.save_chunk(pos, std::move(data));
+                saves.add(Time::getTime() - start);
+
+                data.clear();
+                positions.push_back(pos);
+
+                numFullBytes += get_full_save_size(chunk);
+            });
+
+            const double start = Time::getTime();
+            regionStore.flush();
+            flushTime = Time::getTime() - start;
+        }
+
+        const double numChunks = std::max<size_t>(saves.get_num_ops(), 1);
+
+        char extra[192];
+        snprintf(extra, sizeof(extra), ",\"edits\":%d,"
+                "\"bytes_per_chunk\":%.1f,\"full_bytes_per_chunk\":%.1f,"
+                "\"flush_s\":%.6f", numEdits, numBytes / numChunks,
+                numFullBytes / numChunks, flushTime);
+        saves.report("region_save", extra);
+
+        {
+            RegionStore regionStore(directory);
+            Samples coldLoads, warmLoads;
+
+            evict_region_files(directory);
+
+            load_saved_chunks(regionStore, chunk, generator, coldLoads,
+                    [&](uint32 numFailed) {
+                snprintf(extra, sizeof(extra), ",\"edits\":%d,"
+                        "\"failed\":%u", numEdits, numFailed);
+                coldLoads.report("region_load_cold", extra);
+            });
+
+            load_saved_chunks(regionStore, chunk, generator, warmLoads,
+                    [&](uint32 numFailed) {
+                snprintf(extra, sizeof(extra), ",\"edits\":%d,"
+                        "\"failed\":%u", numEdits, numFailed);
+                warmLoads.report("region_load_warm", extra);
+            });
+        }
+
+        {
+            RegionStore regionStore(directory);
+            Samples loads;
+
+            evict_region_files(directory);
+
+            const double start = Time::getTime();
+            regionStore.prefetch_chunks(positions);
+            const double prefetchTime = Time::getTime() - start;
+
+            load_saved_chunks(regionStore, chunk, generator, loads,
+                    [&](uint32 numFailed) {
+                snprintf(extra, sizeof(extra), ",\"edits\":%d,"
+                        "\"failed\":%u,\"prefetch_s\":%.6f", numEdits,
+                        numFailed, prefetchTime);
+                loads.report("region_load_prefetched", extra);
+            });
+        }
+
+        std::filesystem::remove_all(directory.c_str());
+    }
+
+    void set_camera_position(Camera& camera, const Vector3f& position) {
+        camera.invView = Matrix4f(1.f);
+        camera.invView[3] = Vector4f(position, 1.f);
+    }
+
+    // looks along +x, derives the frustum the way update_camera_system()
+    // does
+    void set_camera_view(Camera& camera, const Vector3f& position) {
+        camera.projection = Math::perspective(Math::toRadians(FIELD_OF_VIEW),
+                ASPECT_RATIO, Z_NEAR, Z_FAR);
+
+        // columns are right, up, back and the position
+        camera.invView = Matrix4f(1.f);
+        camera.invView[0] = Vector4f(0.f, 0.f, 1.f, 0.f);
+        camera.invView[2] = Vector4f(-1.f, 0.f, 0.f, 0.f);
+        camera.invView[3] = Vector4f(position, 1.f);
+
+        camera.view = Math::inverse(camera.invView);
+        camera.viewProjection = camera.projection * camera.view;
+        camera.frustum.update(camera.viewProjection);
+    }
+
+    // runs frames until every chunk in range has been uploaded and had its
+    // blocks compressed or expanded, returns false if the workers did not
+    // catch up in time
+    bool stream_until_idle(ChunkManager& chunkManager, const Camera& camera,
+            Samples& frames) {
+        const double start = Time::getTime();
+
+        for (;;) {
+            const double frameStart = Time::getTime();
+            chunkManager.update(camera);
+            frames.add(Time::getTime() - frameStart);
+
+            if (chunkManager.get_num_pending_chunks() == 0
+                    && chunkManager.get_num_pending_compressions() == 0) {
+                return true;
+            }
+
+            if (Time::getTime() - start > STREAM_TIMEOUT) {
+                return false;
+            }
+
+            Time::sleep(FRAME_TIME);
+        }
+    }
+
+    // time from submitting a job to a worker starting on it
+    void bench_job_wake() {
+        JobSystem jobSystem(1);
+
+        ArrayList<double> startTimes(NUM_WAKE_JOBS);
+        std::atomic<int32> numStarted {0};
+
+        Samples wakes;
+
+        for (int32 i = 0; i < NUM_WAKE_JOBS; ++i) {
+            Time::sleep(WAKE_INTERVAL);
+
+            const double submitTime = Time::getTime();
+
+            jobSystem.submit([&, i]() {
+                startTimes[i] = Time::getTime();
+                ++numStarted;
+            });
+
+            while (numStarted <= i) {
+                Time::sleep(0.0);
+            }
+
+            wakes.add(startTimes[i] - submitTime);
+        }
+
+        wakes.report("job_wake");
+    }
+
+    // share of one core the process takes while nothing is left to load or
+    // mesh, the main thread only runs update() once per frame
+    void bench_idle_cpu(ChunkManager& chunkManager, const Camera& camera) {
+        const double cpuStart = get_cpu_seconds();
+        const double start = Time::getTime();
+
+        while (Time::getTime() - start < IDLE_TIME) {
+            chunkManager.update(camera);
+            Time::sleep(FRAME_TIME);
+        }
+
+        const double cpuSeconds = get_cpu_seconds() - cpuStart;
+        const double seconds = Time::getTime() - start;
+
+        printf("{\"bench\":\"idle_cpu\",\"chunk_size\":%d,\"layout\":\"%s\","
+                "\"wall_s\":%.3f,\"cpu_s\":%.3f,\"cpu_fraction\":%.3f}\n",
+                Chunk::CHUNK_SIZE, BLOCK_LAYOUT, seconds, cpuSeconds,
+                cpuSeconds / seconds);
+        fflush(stdout);
+    }
+
+    // time the main thread spends in render_chunks() while the workers
+    // rebuild the chunks being edited around the camera
+    void bench_render_edits(RenderContext& context, ChunkManager& chunkManager,
+            const Camera& camera, const Vector3f& position) {
+        RenderTarget target(context, 1, 1);
+        Shader shader(context);
+
+        std::mt19937 rng(EDIT_SEED);
+        std::uniform_int_distribution<int32> dist(-EDIT_RADIUS,
+                EDIT_RADIUS - 1);
+
+        const Vector3i center(position);
+
+        Samples renders;
+
+        for (int32 i = 0; i < NUM_EDIT_FRAMES; ++i) {
+            for (int32 j = 0; j < EDITS_PER_FRAME; ++j) {
+                const Vector3i blockPos = center
+                        + Vector3i(dist(rng), dist(rng), dist(rng));
+
+                if (j & 1) {
+                    chunkManager.remove_block(blockPos);
+                }
+                else {
+                    chunkManager.add_block(blockPos, BlockType::STONE);
+                }
+            }
+
+            chunkManager.update(camera);
+
+            const double start = Time::getTime();
+            chunkManager.render_chunks(target, shader, camera);
+            renders.add(Time::getTime() - start);
+
+            Time::sleep(FRAME_TIME);
+        }
+
+        char extra[64];
+        snprintf(extra, sizeof(extra), ",\"edits_per_frame\":%d",
+                EDITS_PER_FRAME);
+
+        renders.report("render_edits", extra);
+    }
+
+    // chunks generated and meshed per second by the initial load for every
+    // worker count, the pool should scale up to the number of cores
+    void bench_stream_scaling(int32 loadDistance) {
+        const uint32 maxWorkers = std::max(std::thread::hardware_concurrency(),
+                MIN_SCALING_WORKERS);
+        const size_t numChunks = loadDistance * loadDistance * loadDistance;
+
+        for (uint32 numWorkers = 1; numWorkers <= maxWorkers; ++numWorkers) {
+            RenderContext context;
+            ChunkManager chunkManager(context, loadDistance,
+                    get_save_directory(), numWorkers);
+
+            Camera camera;
+            set_camera_position(camera,
+                    Vector3f(0.f, FLYTHROUGH_HEIGHT, 0.f));
+
+            chunkManager.set_compression_distance(loadDistance);
+
+            Samples frames;
+            Samples load;
+
+            const double start = Time::getTime();
+            const bool finished = stream_until_idle(chunkManager, camera,
+                    frames);
+            load.add(Time::getTime() - start, numChunks);
+
+            char extra[128];
+            snprintf(extra, sizeof(extra), ",\"load_distance\":%d,"
+                    "\"workers\":%u,\"cores\":%u,\"finished\":%s",
+                    loadDistance, numWorkers,
+                    std::thread::hardware_concurrency(),
+                    finished ? "true" : "false");
+
+            load.report("stream_scaling", extra);
+        }
+    }
+
+    // seconds from a teleport to the first chunk the camera sees being
+    // drawn, to every chunk it sees being drawn and to every chunk in range
+    // being loaded and meshed. This and the benches after it leave position
+    // where the camera ended up, so the next one starts out of range.
+    void bench_teleport(ChunkManager& chunkManager, Vector3f& position) {
+        Camera camera;
+
+        Samples firstVisible;
+        Samples fullView;
+        Samples fullLoad;
+
+        set_camera_view(camera, position);
+
+        // rebuilds the edits left queued would hold up the first teleport
+        double start = Time::getTime();
+
+        while (chunkManager.get_num_queued_jobs() > 0
+                && Time::getTime() - start < STREAM_TIMEOUT) {
+            chunkManager.update(camera);
+            Time::sleep(FRAME_TIME);
+        }
+
+        bool finished = chunkManager.get_num_queued_jobs() == 0;
+
+        for (int32 i = 0; finished && i < NUM_TELEPORTS; ++i) {
+            position.x += TELEPORT_DISTANCE;
+            set_camera_view(camera, position);
+
+            start = Time::getTime();
+            double firstVisibleTime = -1.0;
+
+            for (;;) {
+                chunkManager.update(camera);
+
+                const double time = Time::getTime() - start;
+
+                if (firstVisibleTime < 0.0
+                        && chunkManager.get_num_visible_chunks(camera) > 0) {
+                    firstVisibleTime = time;
+                    firstVisible.add(time);
+                }
+
+                if (chunkManager.get_num_pending_visible_chunks(camera) == 0) {
+                    fullView.add(time);
+                    break;
+                }
+
+                if (time > STREAM_TIMEOUT) {
+                    finished = false;
+                    break;
+                }
+
+                Time::sleep(FRAME_TIME);
+            }
+
+            Samples frames;
+
+            finished = finished && stream_until_idle(chunkManager, camera,
+                    frames);
+            fullLoad.add(Time::getTime() - start);
+        }
+
+        char extra[64];
+        snprintf(extra, sizeof(extra), ",\"finished\":%s",
+                finished ? "true" : "false");
+
+        firstVisible.report("teleport_first_visible", extra);
+        fullView.report("teleport_full_view", extra);
+        fullLoad.report("teleport_full_load", extra);
+    }
+
+    // loads and rebuilds dropped because their chunk moved on or already
+    // had one queued, while flying faster than the chunks stream in
+    void bench_fast_flythrough(ChunkManager& chunkManager,
+            Vector3f& position) {
+        Camera camera;
+
+        ChunkManager::JobCounts loads, rebuilds, edits;
+        chunkManager.get_job_counts(loads, rebuilds, edits);
+
+        Samples frames;
+
+        const double start = Time::getTime();
+
+        for (int32 i = 0; i < NUM_FAST_FRAMES; ++i) {
+            position.x += FAST_STEP;
+            set_camera_view(camera, position);
+
+            const double frameStart = Time::getTime();
+            chunkManager.update(camera);
+            frames.add(Time::getTime() - frameStart);
+
+            Time::sleep(FRAME_TIME);
+        }
+
+        const bool finished = stream_until_idle(chunkManager, camera, frames);
+        const double seconds = Time::getTime() - start;
+
+        ChunkManager::JobCounts endLoads, endRebuilds, endEdits;
+        chunkManager.get_job_counts(endLoads, endRebuilds, endEdits);
+
+        printf("{\"bench\":\"fast_flythrough\",\"chunk_size\":%d,"
+                "\"layout\":\"%s\",\"frames\":%d,\"step\":%.1f,"
+                "\"total_s\":%.3f,\"loads\":%llu,\"stale_loads\":%llu,"
+                "\"coalesced_loads\":%llu,\"rebuilds\":%llu,"
+                "\"stale_rebuilds\":%llu,\"coalesced_rebuilds\":%llu,"
+                "\"finished\":%s}\n", Chunk::CHUNK_SIZE, BLOCK_LAYOUT,
+                NUM_FAST_FRAMES, FAST_STEP, seconds,
+                static_cast<unsigned long long>(endLoads.numRun
+                        - loads.numRun),
+                static_cast<unsigned long long>(endLoads.numStale
+                        - loads.numStale),
+                static_cast<unsigned long long>(endLoads.numCoalesced
+                        - loads.numCoalesced),
+                static_cast<unsigned long long>(endRebuilds.numRun
+                        - rebuilds.numRun),
+                static_cast<unsigned long long>(endRebuilds.numStale
+                        - rebuilds.numStale),
+                static_cast<unsigned long long>(endRebuilds.numCoalesced
+                        - rebuilds.numCoalesced),
+                finished ? "true" : "false");
+        fflush(stdout);
+
+        frames.report("fast_flythrough_update");
+    }
+
+    // time the main thread spends in update() after a teleport, while every
+    // chunk in range finishes at once, with and without an upload budget
+    void bench_upload_budget(ChunkManager& chunkManager, Vector3f& position) {
+        Camera camera;
+
+        for (const bool budgeted : {false, true}) {
+            const size_t numBytes = budgeted ? UPLOAD_BUDGET_BYTES : 0;
+            const double seconds = budgeted ? UPLOAD_BUDGET_TIME : 0.0;
+
+            chunkManager.set_upload_budget(numBytes, seconds);
+
+            const uint64 startBytes = chunkManager.get_num_uploaded_bytes();
+
+            Samples frames;
+            Samples fullView;
+            bool finished = true;
+
+            for (int32 i = 0; finished && i < NUM_BUDGET_TELEPORTS; ++i) {
+                position.x += TELEPORT_DISTANCE;
+                set_camera_view(camera, position);
+
+                const double start = Time::getTime();
+
+                for (;;) {
+                    const double frameStart = Time::getTime();
+                    chunkManager.update(camera);
+                    frames.add(Time::getTime() - frameStart);
+
+                    const double time = Time::getTime() - start;
+
+                    if (chunkManager.get_num_pending_visible_chunks(camera)
+                            == 0) {
+                        fullView.add(time);
+                        break;
+                    }
+
+                    if (time > STREAM_TIMEOUT) {
+                        finished = false;
+                        break;
+                    }
+
+                    Time::sleep(FRAME_TIME);
+                }
+
+                finished = finished && stream_until_idle(chunkManager, camera,
+                        frames);
+            }
+
+            char extra[160];
+            snprintf(extra, sizeof(extra), ",\"budget_bytes\":%zu,"
+                    "\"budget_us\":%.0f,\"uploaded_bytes\":%llu,"
+                    "\"finished\":%s", numBytes, seconds * 1.0e6,
+                    static_cast<unsigned long long>(
+                            chunkManager.get_num_uploaded_bytes() - startBytes),
+                    finished ? "true" : "false");
+
+            frames.report("upload_update", extra);
+            fullView.report("upload_full_view", extra);
+        }
+    }
+
+    void bench_streaming(int32 loadDistance) {
+        RenderContext context;
+        ChunkManager chunkManager(context, loadDistance,
+                get_save_directory());
+
+        Camera camera;
+        Vector3f position(0.f, FLYTHROUGH_HEIGHT, 0.f);
+        set_camera_position(camera, position);
+
+        Samples initialLoad;
+        Samples steps;
+        Samples frames;
+
+        // nothing lies further than half the load distance, so the first
+        // load keeps every chunk expanded
+        chunkManager.set_compression_distance(loadDistance);
+
+        double start = Time::getTime();
+        bool finished = stream_until_idle(chunkManager, camera, frames);
+        initialLoad.add(Time::getTime() - start);
+
+        const size_t expandedResidentBytes = get_resident_bytes();
+        const uint64 expandedBlockBytes = chunkManager.get_block_memory();
+
+        Samples compressFrames;
+        const uint32 compressionDistance = loadDistance / 4;
+
+        chunkManager.set_compression_distance(compressionDistance);
+        finished = finished && stream_until_idle(chunkManager, camera,
+                compressFrames);
+
+        printf("{\"bench\":\"memory\",\"chunk_size\":%d,\"layout\":\"%s\","
+                "\"load_distance\":%d,\"resident_bytes\":%zu,"
+                "\"block_bytes\":%llu,\"compression_distance\":%u,"
+                "\"compressed_resident_bytes\":%zu,"
+                "\"compressed_block_bytes\":%llu,\"draw_calls\":%u,"
+                "\"triangles\":%u}\n", Chunk::CHUNK_SIZE, BLOCK_LAYOUT,
+                loadDistance, expandedResidentBytes,
+                static_cast<unsigned long long>(expandedBlockBytes),
+                compressionDistance, get_resident_bytes(),
+                static_cast<unsigned long long>(chunkManager.get_block_memory()),
+                chunkManager.get_num_renderable_chunks(),
+                chunkManager.get_num_triangles());
+
+        if (finished) {
+            bench_idle_cpu(chunkManager, camera);
+        }
+
+        // every step along +x streams in a new slab once it crosses a border
+        for (int32 i = 0; finished && i < NUM_FLYTHROUGH_STEPS; ++i) {
+            position.x += FLYTHROUGH_STEP;
+            set_camera_position(camera, position);
+
+            start = Time::getTime();
+            finished = stream_until_idle(chunkManager, camera, frames);
+            steps.add(Time::getTime() - start);
+        }
+
+        char extra[128];
+        snprintf(extra, sizeof(extra), ",\"load_distance\":%d,\"finished\":%s",
+                loadDistance, finished ? "true" : "false");
+
+        initialLoad.report("stream_initial", extra);
+        steps.report("stream_step", extra);
+        frames.report("stream_update", extra);
+
+        if (!finished) {
+            return;
+        }
+
+        std::mt19937 rng(RAY_SEED);
+        std::uniform_real_distribution<float> dist(-1.f, 1.f);
+
+        Samples rays;
+        uint32 numHits = 0;
+
+        for (int32 i = 0; i < NUM_RAYS; ++i) {
+            // aim below the horizon so most rays can reach the terrain
+            const float x = dist(rng);
+            const float y = -0.25f - 0.75f * std::abs(dist(rng));
+            const float z = dist(rng);
+
+            const Vector3f direction = Math::normalize(Vector3f(x, y, z));
+
+            Vector3i blockPos;
+            Vector3i sideDir;
+
+            const double rayStart = Time::getTime();
+
+            if (chunkManager.find_block_on_ray(position, direction, blockPos,
+                    sideDir)) {
+                ++numHits;
+            }
+
+            rays.add(Time::getTime() - rayStart);
+        }
+
+        snprintf(extra, sizeof(extra), ",\"hits\":%u", numHits);
+        rays.report("raycast", extra);
+
+        bench_render_edits(context, chunkManager, camera, position);
+        bench_teleport(chunkManager, position);
+        bench_fast_flythrough(chunkManager, position);
+        bench_upload_budget(chunkManager, position);
+    }
+};
+
+int main(int argc, char** argv) {
+    // in chunks when given
+    const int32 loadDistance = argc > 1 ? atoi(argv[1])
+            : DEFAULT_VIEW_DISTANCE / Chunk::CHUNK_SIZE;
+
+    TerrainGenerator generator;
+    Chunk* chunk = new Chunk();
+
+    bench_terrain(*chunk, generator);
+    const uint64 plainQuads = bench_mesher("mesh_binary", MesherType::BINARY,
+            *chunk, generator);
+    bench_mesher("mesh_mask", MesherType::MASK, *chunk, generator);
+    bench_block_storage(*chunk, generator);
+    bench_block_compression(*chunk, generator);
+    bench_region_store(*chunk, generator, NUM_SPARSE_EDITS);
+    bench_region_store(*chunk, generator, NUM_DENSE_EDITS);
+
+    bench_job_wake();
+    bench_stream_scaling(loadDistance);
+    bench_streaming(loadDistance);
+
+    // last, the types they register stay in the registry for good
+    bench_mesher_types(*chunk, generator, FEW_CHUNK_TYPES, plainQuads);
+    bench_mesher_types(*chunk, generator, MANY_CHUNK_TYPES, plainQuads);
+
+    delete chunk;
+
+    return 0;
+}
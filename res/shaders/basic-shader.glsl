@@ -4,10 +4,10 @@ varying vec3 in_color;
 
 #if defined(VS_BUILD)
 
-layout (location = 0) in vec3 position;
-layout (location = 1) in vec3 normal;
-layout (location = 2) in vec3 color;
-layout (location = 3) in vec3 chunkPosition;
+// ChunkVertex, the packed position, side and AO then the BlockType, must
+// match ChunkBuilder::pack_vertex
+layout (location = 0) in uvec2 vertex;
+layout (location = 1) in vec3 chunkPosition;
 
 layout (std140, binding = 0) uniform CameraData {
     mat4 viewProjection;
@@ -15,11 +15,52 @@ layout (std140, binding = 0) uniform CameraData {
 
 const vec3 LIGHT_DIR = normalize(vec3(-0.5, 1.0, 1.0));
 
+const float BLOCK_RENDER_SIZE = 0.5;
+
+// set by ChunkBuilder::get_shader_defines() for the chunk size of the build
+#ifndef CHUNK_POSITION_BITS
+    #define CHUNK_POSITION_BITS 5u
+#endif
+
+const uint POSITION_BITS = CHUNK_POSITION_BITS;
+const uint POSITION_MASK = (1u << POSITION_BITS) - 1u;
+const uint SIDE_SHIFT = 3u * POSITION_BITS;
+const uint SIDE_MASK = 7u;
+const uint AO_SHIFT = SIDE_SHIFT + 3u;
+const uint AO_MASK = 3u;
+
+// brightness per baked AO level, 0 is fully occluded
+const float AO_CURVE[4] = float[4](0.45, 0.65, 0.85, 1.0);
+
+// indexed by Side, matches get_normal() in chunk-builder.cpp
+const vec3 NORMALS[6] = vec3[6](
+    vec3(0.0, 0.0, 1.0),
+    vec3(0.0, 0.0, -1.0),
+    vec3(-1.0, 0.0, 0.0),
+    vec3(1.0, 0.0, 0.0),
+    vec3(0.0, 1.0, 0.0),
+    vec3(0.0, -1.0, 0.0)
+);
+
+// indexed by BlockType, the color and the light emitted, which no shading
+// or AO darkens below
+layout (std430, binding = 1) readonly buffer BlockColors {
+    vec4 blockColors[];
+};
+
 void main() {
+    const uint packed = vertex.x;
+
+    const vec3 position = vec3(uvec3(packed, packed >> POSITION_BITS,
+            packed >> (2u * POSITION_BITS)) & POSITION_MASK) - BLOCK_RENDER_SIZE;
+    const vec3 normal = NORMALS[(packed >> SIDE_SHIFT) & SIDE_MASK];
+    const vec4 color = blockColors[vertex.y];
+    const float ao = AO_CURVE[(packed >> AO_SHIFT) & AO_MASK];
+
     const float light_power = fma(clamp(dot(normal, LIGHT_DIR), 0.0, 1.0), 0.8, 0.2);
 
     gl_Position = viewProjection * vec4(position + chunkPosition, 1.0);
-    in_color = color * light_power;
+    in_color = color.rgb * max(light_power * ao, color.a);
 }
 
 #elif defined(FS_BUILD)
@@ -0,0 +1,177 @@
+#include "block-registry.hpp"
+
+#include <engine/math/math.hpp>
+
+#include <fstream>
+
+namespace {
+    // every id has to fit in BlockType
+    constexpr const uint32 MAX_TYPES = uint32(UINT16_MAX) + 1;
+
+    struct TypeEntry {
+        String name;
+        Vector3f color;
+        float opacity;
+        bool solid;
+        float emission;
+        MeshingMode meshingMode;
+    };
+
+    bool parse_meshing_mode(const String& name, MeshingMode& meshingMode) {
+        if (name == "none") {
+            meshingMode = MeshingMode::NONE;
+        }
+        else if (name == "cube") {
+            meshingMode = MeshingMode::CUBE;
+        }
+        else {
+            return false;
+        }
+
+        return true;
+    }
+
+    // name red green blue opacity solid emission meshing, colors 0 to 255
+    bool parse_entry(const String& line, TypeEntry& entry) {
+        StringStream stream(line);
+
+        int32 red, green, blue, solid;
+        String meshingMode, rest;
+
+        if (!(stream >> entry.name >> red >> green >> blue >> entry.opacity
+                >> solid >> entry.emission >> meshingMode) || stream >> rest) {
+            return false;
+        }
+
+        if (red < 0 || red > 255 || green < 0 || green > 255 || blue < 0
+                || blue > 255 || entry.opacity < 0.f || entry.opacity > 1.f
+                || (solid != 0 && solid != 1) || entry.emission < 0.f) {
+            return false;
+        }
+
+        entry.color = Vector3f(red, green, blue) / 255.f;
+        entry.solid = solid != 0;
+
+        return parse_meshing_mode(meshingMode, entry.meshingMode);
+    }
+};
+
+BlockRegistry::BlockRegistry() {
+    add_type("air", Vector3f(0.f, 0.f, 0.f), 0.f, false, 0.f,
+            MeshingMode::NONE);
+    add_type("grass", Vector3f(36.f, 130.f, 45.f) / 255.f, 1.f, true, 0.f,
+            MeshingMode::CUBE);
+    add_type("dirt", Vector3f(127.f, 91.f, 40.f) / 255.f, 1.f, true, 0.f,
+            MeshingMode::CUBE);
+    add_type("stone", Vector3f(0.5f, 0.5f, 0.5f), 1.f, true, 0.f,
+            MeshingMode::CUBE);
+}
+
+bool BlockRegistry::load(const String& fileName, uint32 maxTypes) {
+    std::ifstream file(fileName);
+
+    if (!file.is_open()) {
+        DEBUG_LOG("BlockRegistry", LOG_ERROR, "Failed to open %s",
+                fileName.c_str());
+
+        return false;
+    }
+
+    ArrayList<TypeEntry> entries;
+    ArrayList<uint32> ids;
+    uint32 numTypes = get_num_types();
+
+    // the names listed so far, which load() may not see twice
+    HashMap<String, uint32> listedIds;
+
+    String line;
+
+    for (uint32 lineNumber = 1; std::getline(file, line); ++lineNumber) {
+        const size_t begin = line.find_first_not_of(" \t\r");
+
+        if (begin == String::npos || line[begin] == '#') {
+            continue;
+        }
+
+        TypeEntry entry;
+
+        if (!parse_entry(line, entry)) {
+            DEBUG_LOG("BlockRegistry", LOG_ERROR, "%s:%u: malformed block type",
+                    fileName.c_str(), lineNumber);
+
+            return false;
+        }
+
+        // built in types keep their ids, the rest are numbered in order
+        const auto it = typesByName.find(entry.name);
+        const uint32 id = it != std::end(typesByName)
+                ? static_cast<uint32>(it->second) : numTypes;
+
+        if (!listedIds.emplace(entry.name, id).second) {
+            DEBUG_LOG("BlockRegistry", LOG_ERROR,
+                    "%s:%u: block type %s listed twice", fileName.c_str(),
+                    lineNumber, entry.name.c_str());
+
+            return false;
+        }
+
+        if (id == numTypes) {
+            ++numTypes;
+        }
+
+        ids.push_back(id);
+        entries.push_back(std::move(entry));
+    }
+
+    if (numTypes > Math::min(maxTypes, MAX_TYPES)) {
+        DEBUG_LOG("BlockRegistry", LOG_ERROR,
+                "%s lists %u block types, only %u fit", fileName.c_str(),
+                numTypes, Math::min(maxTypes, MAX_TYPES));
+
+        return false;
+    }
+
+    for (uint32 i = 0; i < entries.size(); ++i) {
+        const TypeEntry& entry = entries[i];
+
+        if (ids[i] == names.size()) {
+            add_type(entry.name, entry.color, entry.opacity, entry.solid,
+                    entry.emission, entry.meshingMode);
+            continue;
+        }
+
+        colors[ids[i]] = entry.color;
+        opacity[ids[i]] = entry.opacity;
+        solid[ids[i]] = entry.solid;
+        emission[ids[i]] = entry.emission;
+        meshingModes[ids[i]] = entry.meshingMode;
+    }
+
+    return true;
+}
+
+uint32 BlockRegistry::get_num_types() const noexcept {
+    return static_cast<uint32>(names.size());
+}
+
+BlockType BlockRegistry::find_type(const String& name) const {
+    const auto it = typesByName.find(name);
+
+    return it != std::end(typesByName) ? it->second : BlockType::AIR;
+}
+
+const String& BlockRegistry::get_name(BlockType type) const {
+    return names[static_cast<uint32>(type)];
+}
+
+void BlockRegistry::add_type(const String& name, const Vector3f& color,
+        float opacity, bool solid, float emission,
+        MeshingMode meshingMode) {
+    typesByName.emplace(name, static_cast<BlockType>(names.size()));
+    names.push_back(name);
+    colors.push_back(color);
+    this->opacity.push_back(opacity);
+    this->solid.push_back(solid);
+    this->emission.push_back(emission);
+    meshingModes.push_back(meshingMode);
+}
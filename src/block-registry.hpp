@@ -0,0 +1,92 @@
+#pragma once
+
+#include <engine/core/common.hpp>
+#include <engine/core/array-list.hpp>
+#include <engine/core/hash-map.hpp>
+#include <engine/core/string.hpp>
+#include <engine/core/singleton.hpp>
+
+#include <engine/math/vector.hpp>
+
+#include "block.hpp"
+
+enum class MeshingMode : uint8 {
+    NONE = 0, // never meshed nor hit by rays, like air
+    CUBE,     // full faces, culled against opaque neighbors
+
+    NUM_MODES
+};
+
+// Properties of every block type, one flat table per property indexed by the
+// BlockType id, so the mesher and the shader look them up without branching
+// on the type. The built in types of BlockType are always registered under
+// their enum values, load() updates them and appends the types listed in a
+// data file, see res/blocks.txt for the format.
+//
+// Ids follow the order of the file and are what saved chunks store, so new
+// types go at its end. The registry is filled once before any chunk loads
+// and only read afterwards, which lets the workers share it without a lock.
+class BlockRegistry final : public Singleton<BlockRegistry> {
+    public:
+        BlockRegistry();
+
+        // returns false and keeps the types registered before when the file
+        // cannot be read, is malformed or lists more than maxTypes types
+        bool load(const String& fileName, uint32 maxTypes);
+
+        uint32 get_num_types() const noexcept;
+
+        // returns BlockType::AIR when no type has that name
+        BlockType find_type(const String& name) const;
+
+        const String& get_name(BlockType type) const;
+
+        inline const Vector3f& get_color(BlockType type) const noexcept {
+            return colors[static_cast<uint32>(type)];
+        }
+
+        // share of the light behind the block it lets through, 0 to 1
+        inline float get_opacity(BlockType type) const noexcept {
+            return opacity[static_cast<uint32>(type)];
+        }
+
+        // set for types placed blocks are active with
+        inline bool is_solid(BlockType type) const noexcept {
+            return solid[static_cast<uint32>(type)] != 0;
+        }
+
+        // light the block gives off, 0 for none
+        inline float get_emission(BlockType type) const noexcept {
+            return emission[static_cast<uint32>(type)];
+        }
+
+        inline MeshingMode get_meshing_mode(BlockType type) const noexcept {
+            return meshingModes[static_cast<uint32>(type)];
+        }
+
+        // gets faces of its own where it is solid, and can be hit by rays
+        inline bool is_meshed(BlockType type) const noexcept {
+            return meshingModes[static_cast<uint32>(type)] != MeshingMode::NONE;
+        }
+
+        // hides the faces of the solid blocks next to it, only fully opaque
+        // cubes do
+        inline bool is_opaque(BlockType type) const noexcept {
+            return (meshingModes[static_cast<uint32>(type)] == MeshingMode::CUBE)
+                    & (opacity[static_cast<uint32>(type)] >= 1.f);
+        }
+    private:
+        NULL_COPY_AND_ASSIGN(BlockRegistry);
+
+        ArrayList<String> names;
+        HashMap<String, BlockType> typesByName;
+        ArrayList<Vector3f> colors;
+        ArrayList<float> opacity;
+        ArrayList<uint8> solid;
+        ArrayList<float> emission;
+        ArrayList<MeshingMode> meshingModes;
+
+        void add_type(const String& name, const Vector3f& color,
+                float opacity, bool solid, float emission,
+                MeshingMode meshingMode);
+};
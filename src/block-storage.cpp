@@ -0,0 +1,770 @@
+#include "block-storage.hpp"
+
+#include <engine/core/memory.hpp>
+#include <engine/core/hash-map.hpp>
+#include <engine/math/math.hpp>
+
+#include <algorithm>
+#include <mutex>
+#include <new>
+
+#if defined(OPERATING_SYSTEM_LINUX)
+    #include <sys/mman.h>
+    #include <unistd.h>
+#endif
+
+#include "block-registry.hpp"
+
+namespace {
+    constexpr const uint32 WORD_BITS = 64;
+
+    // palette size and width ahead of the palette in write()
+    constexpr const size_t HEADER_SIZE = 4;
+    // active flag then the 16 bit type
+    constexpr const size_t ENTRY_SIZE = 3;
+
+    // runs keep the palette index in their low bits, which leaves 20 bits
+    // for the end of the run, enough for the 64^3 blocks of a chunk
+    constexpr const uint32 RUN_PALETTE_BITS = 12;
+    constexpr const uint32 RUN_PALETTE_MASK = (1 << RUN_PALETTE_BITS) - 1;
+    constexpr const uint32 MAX_RUN_BLOCKS = uint32(1) << (32 - RUN_PALETTE_BITS);
+
+    // storages allocated together whenever the slab runs dry
+    constexpr const uint32 STORAGES_PER_PAGE = 64;
+    // index words are carved from pages of at least this many bytes
+    constexpr const size_t WORD_PAGE_SIZE = 64 * 1024;
+
+    struct WordClass {
+        size_t numWords;
+        // a min heap on the address, handing out the lowest free words
+        // first packs the words in use into as few pages as it can, which
+        // leaves whole pages free to release once chunks are compressed
+        ArrayList<uint64*> freeWords;
+    };
+
+    struct WordPage {
+        void* memory;
+        size_t numBytes;
+    };
+
+    struct StorageSlab {
+        ArrayList<void*> storagePages;
+        ArrayList<WordPage> wordPages;
+
+        ArrayList<BlockStorage*> freeStorages;
+        ArrayList<WordClass> wordClasses;
+
+        // index words in use on each OS page shared by several of them,
+        // by page address. Pages larger words span are not counted
+        HashMap<uintptr, uint32> pageUses;
+        size_t osPageSize = 0;
+
+        std::mutex mutex;
+
+        ~StorageSlab() {
+            // destroying the storages hands their words back, so the word
+            // pages have to outlive them
+            for (void* page : storagePages) {
+                BlockStorage* storages = static_cast<BlockStorage*>(page);
+
+                for (uint32 i = 0; i < STORAGES_PER_PAGE; ++i) {
+                    storages[i].~BlockStorage();
+                }
+
+                Memory::free(page);
+            }
+
+            for (const WordPage& page : wordPages) {
+                free_word_page(page);
+            }
+        }
+
+        // word pages are mapped on their own where the OS allows it, so the
+        // pages under words compress() frees can be handed back to it
+        static void* allocate_word_page(size_t numBytes) {
+#if defined(OPERATING_SYSTEM_LINUX)
+            void* memory = mmap(nullptr, numBytes, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+            if (memory == MAP_FAILED) {
+                throw std::bad_alloc();
+            }
+
+            return memory;
+#else
+            return Memory::malloc(numBytes);
+#endif
+        }
+
+        static void free_word_page(const WordPage& page) {
+#if defined(OPERATING_SYSTEM_LINUX)
+            munmap(page.memory, page.numBytes);
+#else
+            Memory::free(page.memory);
+#endif
+        }
+    };
+
+    StorageSlab slab;
+
+    // expects the slab mutex to be held
+    size_t get_os_page_size() {
+        if (slab.osPageSize == 0) {
+#if defined(OPERATING_SYSTEM_LINUX)
+            slab.osPageSize = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+#else
+            slab.osPageSize = WORD_PAGE_SIZE;
+#endif
+        }
+
+        return slab.osPageSize;
+    }
+
+    // words come in power of two sizes carved from OS page aligned word
+    // pages, so they either share whole OS pages or span whole ones
+    bool shares_os_page(size_t numBytes) {
+        return numBytes < get_os_page_size()
+                && get_os_page_size() % numBytes == 0;
+    }
+
+    // the contents of the OS pages are dropped, they read as zeros and
+    // take memory again once they are written to
+    void release_os_pages(void* memory, size_t numBytes) {
+#if defined(OPERATING_SYSTEM_LINUX)
+        madvise(memory, numBytes, MADV_DONTNEED);
+#else
+        (void)memory;
+        (void)numBytes;
+#endif
+    }
+
+    constexpr uint32 get_bits_for_palette(size_t paletteSize) {
+        return paletteSize <= 1 ? 0
+                : paletteSize <= 2 ? 1
+                : paletteSize <= 4 ? 2
+                : paletteSize <= 16 ? 4
+                : paletteSize <= 256 ? 8 : 16;
+    }
+
+    constexpr size_t get_num_words(uint32 numBlocks, uint32 bitsPerBlock) {
+        return static_cast<size_t>(numBlocks) * bitsPerBlock / WORD_BITS;
+    }
+
+    // expects the slab mutex to be held
+    WordClass& get_word_class(size_t numWords) {
+        for (auto& wordClass : slab.wordClasses) {
+            if (wordClass.numWords == numWords) {
+                return wordClass;
+            }
+        }
+
+        slab.wordClasses.push_back({numWords, {}});
+
+        return slab.wordClasses.back();
+    }
+
+    uint64* allocate_words(size_t numWords) {
+        if (numWords == 0) {
+            return nullptr;
+        }
+
+        std::lock_guard<std::mutex> lock(slab.mutex);
+
+        WordClass& wordClass = get_word_class(numWords);
+        const size_t numBytes = numWords * sizeof(uint64);
+
+        if (wordClass.freeWords.empty()) {
+            const size_t numPerPage = Math::max(WORD_PAGE_SIZE / numBytes,
+                    size_t(1));
+
+            uint64* page = static_cast<uint64*>(
+                    StorageSlab::allocate_word_page(numPerPage * numBytes));
+            slab.wordPages.push_back({page, numPerPage * numBytes});
+
+            for (size_t i = 0; i < numPerPage; ++i) {
+                wordClass.freeWords.push_back(page + i * numWords);
+                std::push_heap(std::begin(wordClass.freeWords),
+                        std::end(wordClass.freeWords), std::greater<>());
+            }
+        }
+
+        std::pop_heap(std::begin(wordClass.freeWords),
+                std::end(wordClass.freeWords), std::greater<>());
+
+        uint64* words = wordClass.freeWords.back();
+        wordClass.freeWords.pop_back();
+
+        if (shares_os_page(numBytes)) {
+            ++slab.pageUses[reinterpret_cast<uintptr>(words)
+                    & ~(get_os_page_size() - 1)];
+        }
+
+        return words;
+    }
+
+    // releasePages hands the OS pages no words are left on back to the OS,
+    // for words that are not about to be replaced by others
+    void free_words(uint64* words, size_t numWords,
+            bool releasePages = false) {
+        if (words == nullptr) {
+            return;
+        }
+
+        std::lock_guard<std::mutex> lock(slab.mutex);
+        WordClass& wordClass = get_word_class(numWords);
+
+        wordClass.freeWords.push_back(words);
+        std::push_heap(std::begin(wordClass.freeWords),
+                std::end(wordClass.freeWords), std::greater<>());
+
+        const size_t numBytes = numWords * sizeof(uint64);
+
+        if (!shares_os_page(numBytes)) {
+            if (releasePages && numBytes % get_os_page_size() == 0) {
+                release_os_pages(words, numBytes);
+            }
+
+            return;
+        }
+
+        const uintptr osPage = reinterpret_cast<uintptr>(words)
+                & ~(get_os_page_size() - 1);
+        auto it = slab.pageUses.find(osPage);
+
+        if (--it->second == 0) {
+            slab.pageUses.erase(it);
+
+            if (releasePages) {
+                release_os_pages(reinterpret_cast<void*>(osPage),
+                        get_os_page_size());
+            }
+        }
+    }
+
+    // Block::operator== only compares types
+    bool is_same_block(const Block& a, const Block& b) {
+        return a.is_active() == b.is_active() && a.get_type() == b.get_type();
+    }
+
+    uint32 read_index(const uint64* words, uint32 bitsPerBlock,
+            uint32 index) {
+        const uint32 bit = index * bitsPerBlock;
+
+        return static_cast<uint32>((words[bit / WORD_BITS] >> (bit % WORD_BITS))
+                & ((uint64(1) << bitsPerBlock) - 1));
+    }
+
+    void write_index(uint64* words, uint32 bitsPerBlock, uint32 index,
+            uint32 paletteIndex) {
+        const uint32 bit = index * bitsPerBlock;
+        const uint64 mask = ((uint64(1) << bitsPerBlock) - 1) << (bit % WORD_BITS);
+
+        uint64& word = words[bit / WORD_BITS];
+        word = (word & ~mask)
+                | (static_cast<uint64>(paletteIndex) << (bit % WORD_BITS));
+    }
+
+    // widths divide the word size, so no index straddles two words and a
+    // whole word unpacks with constant shifts
+    template <uint32 BITS>
+    void decode_words(const uint64* words, const Block* palette,
+            Block* blocks, uint32 numBlocks) {
+        constexpr const uint32 PER_WORD = WORD_BITS / BITS;
+        constexpr const uint64 MASK = (uint64(1) << BITS) - 1;
+
+        for (uint32 i = 0; i < numBlocks; i += PER_WORD) {
+            uint64 word = *words++;
+
+            for (uint32 j = 0; j < PER_WORD; ++j) {
+                blocks[i + j] = palette[word & MASK];
+                word >>= BITS;
+            }
+        }
+    }
+};
+
+BlockStorage::BlockStorage(uint32 numBlocks)
+        : palette(1)
+        , words(nullptr)
+        , runs(nullptr)
+        , numBlocks(numBlocks)
+        , bitsPerBlock(0)
+        , numRuns(0)
+        , numReferences {0} {}
+
+BlockStorage* BlockStorage::acquire(uint32 numBlocks) {
+    std::unique_lock<std::mutex> lock(slab.mutex);
+
+    if (slab.freeStorages.empty()) {
+        void* page = Memory::malloc(STORAGES_PER_PAGE * sizeof(BlockStorage));
+        BlockStorage* storages = static_cast<BlockStorage*>(page);
+
+        slab.storagePages.push_back(page);
+
+        for (uint32 i = 0; i < STORAGES_PER_PAGE; ++i) {
+            new (storages + i) BlockStorage(numBlocks);
+            slab.freeStorages.push_back(storages + i);
+        }
+    }
+
+    BlockStorage* storage = slab.freeStorages.back();
+    slab.freeStorages.pop_back();
+
+    lock.unlock();
+
+    storage->numBlocks = numBlocks;
+    storage->numReferences.store(1, std::memory_order_relaxed);
+
+    return storage;
+}
+
+void BlockStorage::release(BlockStorage* storage) {
+    // the last reader to let go of a replaced snapshot frees it
+    if (storage->numReferences.fetch_sub(1, std::memory_order_acq_rel) > 1) {
+        return;
+    }
+
+    // hands the index words back before the storage joins the free list
+    storage->fill(Block());
+
+    std::lock_guard<std::mutex> lock(slab.mutex);
+    slab.freeStorages.push_back(storage);
+}
+
+void BlockStorage::add_reference() noexcept {
+    numReferences.fetch_add(1, std::memory_order_relaxed);
+}
+
+bool BlockStorage::is_shared() const noexcept {
+    // pairs with the release in release(), so the reads of a snapshot are
+    // done before its owner changes it
+    return numReferences.load(std::memory_order_acquire) > 1;
+}
+
+Block BlockStorage::get(uint32 index) const noexcept {
+    return palette[get_palette_index(index)];
+}
+
+void BlockStorage::set(uint32 index, const Block& block) {
+    decompress();
+
+    uint32 paletteIndex = find_in_palette(block);
+
+    if (paletteIndex == palette.size()) {
+        // reuse entries freed by earlier edits before widening
+        if (palette.size() >= (size_t(1) << bitsPerBlock)) {
+            repack();
+        }
+
+        if (palette.size() >= (size_t(1) << bitsPerBlock)) {
+            set_bits_per_block(get_bits_for_palette(palette.size() + 1));
+        }
+
+        paletteIndex = static_cast<uint32>(palette.size());
+        palette.push_back(block);
+    }
+
+    set_palette_index(index, paletteIndex);
+}
+
+void BlockStorage::fill(const Block& block) {
+    free_words(words, get_num_words(numBlocks, bitsPerBlock));
+    free_runs();
+
+    palette.assign(1, block);
+    words = nullptr;
+    bitsPerBlock = 0;
+}
+
+void BlockStorage::assign(const Block* palette, uint32 paletteSize,
+        const uint8* indices) {
+    constexpr const uint32 UNUSED = UINT32_MAX;
+
+    uint32 remap[256];
+
+    for (uint32 i = 0; i < paletteSize; ++i) {
+        remap[i] = UNUSED;
+    }
+
+    for (uint32 i = 0; i < numBlocks; ++i) {
+        remap[indices[i]] = 0;
+    }
+
+    free_words(words, get_num_words(numBlocks, bitsPerBlock));
+    free_runs();
+    this->palette.clear();
+
+    for (uint32 i = 0; i < paletteSize; ++i) {
+        if (remap[i] != UNUSED) {
+            remap[i] = static_cast<uint32>(this->palette.size());
+            this->palette.push_back(palette[i]);
+        }
+    }
+
+    // size the words for the final width up front rather than packing at
+    // 8 bits and narrowing afterwards
+    bitsPerBlock = get_bits_for_palette(this->palette.size());
+    words = allocate_words(get_num_words(numBlocks, bitsPerBlock));
+
+    if (bitsPerBlock > 0) {
+        for (uint32 i = 0; i < numBlocks; ++i) {
+            write_index(words, bitsPerBlock, i, remap[indices[i]]);
+        }
+    }
+}
+
+void BlockStorage::assign(const BlockStorage& other) {
+    free_words(words, get_num_words(numBlocks, bitsPerBlock));
+    free_runs();
+
+    palette = other.palette;
+    numBlocks = other.numBlocks;
+    bitsPerBlock = other.bitsPerBlock;
+    words = nullptr;
+
+    if (other.runs) {
+        runs = static_cast<uint32*>(Memory::malloc(other.numRuns
+                * sizeof(uint32)));
+        numRuns = other.numRuns;
+
+        Memory::memcpy(runs, other.runs, numRuns * sizeof(uint32));
+    }
+    else {
+        const size_t numWords = get_num_words(numBlocks, bitsPerBlock);
+
+        words = allocate_words(numWords);
+
+        if (numWords > 0) {
+            Memory::memcpy(words, other.words, numWords * sizeof(uint64));
+        }
+    }
+}
+
+void BlockStorage::decode(Block* blocks) const {
+    if (runs) {
+        uint32 begin = 0;
+
+        for (uint32 i = 0; i < numRuns; ++i) {
+            const uint32 run = runs[i];
+            const uint32 end = run >> RUN_PALETTE_BITS;
+
+            std::fill(blocks + begin, blocks + end,
+                    palette[run & RUN_PALETTE_MASK]);
+            begin = end;
+        }
+
+        return;
+    }
+
+    switch (bitsPerBlock) {
+        case 0:
+            for (uint32 i = 0; i < numBlocks; ++i) {
+                blocks[i] = palette[0];
+            }
+            break;
+        case 1:
+            decode_words<1>(words, palette.data(), blocks, numBlocks);
+            break;
+        case 2:
+            decode_words<2>(words, palette.data(), blocks, numBlocks);
+            break;
+        case 4:
+            decode_words<4>(words, palette.data(), blocks, numBlocks);
+            break;
+        case 8:
+            decode_words<8>(words, palette.data(), blocks, numBlocks);
+            break;
+        default:
+            decode_words<16>(words, palette.data(), blocks, numBlocks);
+    }
+}
+
+void BlockStorage::repack() {
+    if (bitsPerBlock == 0) {
+        return;
+    }
+
+    decompress();
+
+    constexpr const uint32 UNUSED = UINT32_MAX;
+
+    ArrayList<uint32> remap(palette.size(), UNUSED);
+
+    for (uint32 i = 0; i < numBlocks; ++i) {
+        remap[get_palette_index(i)] = 0;
+    }
+
+    uint32 newSize = 0;
+
+    for (size_t i = 0; i < palette.size(); ++i) {
+        if (remap[i] != UNUSED) {
+            remap[i] = newSize;
+            palette[newSize++] = palette[i];
+        }
+    }
+
+    const uint32 newBits = get_bits_for_palette(newSize);
+
+    if (newSize == palette.size() && newBits == bitsPerBlock) {
+        return;
+    }
+
+    palette.resize(newSize);
+    set_bits_per_block(newBits, remap.data());
+}
+
+void BlockStorage::write(ArrayList<uint8>& data) const {
+    const size_t numWords = get_num_words(numBlocks, bitsPerBlock);
+    const uint16 paletteSize = static_cast<uint16>(palette.size());
+
+    const size_t offset = data.size();
+    data.resize(offset + HEADER_SIZE + palette.size() * ENTRY_SIZE
+            + numWords * sizeof(uint64));
+
+    uint8* out = data.data() + offset;
+
+    Memory::memcpy(out, &paletteSize, sizeof(paletteSize));
+    out[2] = static_cast<uint8>(bitsPerBlock);
+    out[3] = 0;
+    out += HEADER_SIZE;
+
+    for (const Block& block : palette) {
+        const uint16 type = static_cast<uint16>(block.get_type());
+
+        out[0] = block.is_active();
+        Memory::memcpy(out + 1, &type, sizeof(type));
+        out += ENTRY_SIZE;
+    }
+
+    if (runs) {
+        ArrayList<uint64> expanded(numWords);
+        expand_runs(expanded.data());
+
+        Memory::memcpy(out, expanded.data(), numWords * sizeof(uint64));
+    }
+    else if (numWords > 0) {
+        Memory::memcpy(out, words, numWords * sizeof(uint64));
+    }
+}
+
+bool BlockStorage::read(const uint8* data, size_t size) {
+    if (size < HEADER_SIZE) {
+        return false;
+    }
+
+    uint16 paletteSize;
+    Memory::memcpy(&paletteSize, data, sizeof(paletteSize));
+
+    const uint32 newBits = data[2];
+
+    // widths are 0 or a power of two that divides the word size
+    if (paletteSize == 0 || newBits > 16 || (newBits & (newBits - 1)) != 0
+            || paletteSize > (uint32(1) << newBits)) {
+        return false;
+    }
+
+    const size_t numWords = get_num_words(numBlocks, newBits);
+
+    if (size != HEADER_SIZE + paletteSize * ENTRY_SIZE
+            + numWords * sizeof(uint64)) {
+        return false;
+    }
+
+    ArrayList<Block> newPalette;
+    newPalette.reserve(paletteSize);
+
+    const uint8* in = data + HEADER_SIZE;
+    const uint32 numTypes = BlockRegistry::getInstance().get_num_types();
+
+    for (uint32 i = 0; i < paletteSize; ++i, in += ENTRY_SIZE) {
+        uint16 type;
+        Memory::memcpy(&type, in + 1, sizeof(type));
+
+        if (in[0] > 1 || type >= numTypes) {
+            return false;
+        }
+
+        newPalette.emplace_back(in[0] != 0, static_cast<BlockType>(type));
+    }
+
+    uint64* newWords = allocate_words(numWords);
+
+    if (numWords > 0) {
+        Memory::memcpy(newWords, in, numWords * sizeof(uint64));
+    }
+
+    // every index has to name an entry unless the palette fills the width
+    if (paletteSize < (uint32(1) << newBits)) {
+        for (uint32 i = 0; i < numBlocks; ++i) {
+            if (read_index(newWords, newBits, i) >= paletteSize) {
+                free_words(newWords, numWords);
+                return false;
+            }
+        }
+    }
+
+    free_words(words, get_num_words(numBlocks, bitsPerBlock));
+    free_runs();
+
+    palette = std::move(newPalette);
+    words = newWords;
+    bitsPerBlock = newBits;
+
+    return true;
+}
+
+bool BlockStorage::compress() {
+    if (runs || bitsPerBlock == 0
+            || palette.size() > RUN_PALETTE_MASK + 1
+            || numBlocks > MAX_RUN_BLOCKS) {
+        return false;
+    }
+
+    const size_t numWords = get_num_words(numBlocks, bitsPerBlock);
+
+    // counted first, so storages that would not shrink are left alone
+    uint32 newNumRuns = 1;
+
+    for (uint32 i = 1; i < numBlocks; ++i) {
+        newNumRuns += read_index(words, bitsPerBlock, i)
+                != read_index(words, bitsPerBlock, i - 1);
+    }
+
+    if (newNumRuns * sizeof(uint32) >= numWords * sizeof(uint64)) {
+        return false;
+    }
+
+    runs = static_cast<uint32*>(Memory::malloc(newNumRuns * sizeof(uint32)));
+
+    uint32 paletteIndex = read_index(words, bitsPerBlock, 0);
+
+    for (uint32 i = 1; i <= numBlocks; ++i) {
+        const uint32 next = i < numBlocks
+                ? read_index(words, bitsPerBlock, i) : UINT32_MAX;
+
+        if (next != paletteIndex) {
+            runs[numRuns++] = (i << RUN_PALETTE_BITS) | paletteIndex;
+            paletteIndex = next;
+        }
+    }
+
+    free_words(words, numWords, true);
+    words = nullptr;
+
+    return true;
+}
+
+void BlockStorage::decompress() {
+    if (!runs) {
+        return;
+    }
+
+    uint64* newWords = allocate_words(get_num_words(numBlocks, bitsPerBlock));
+    expand_runs(newWords);
+
+    free_runs();
+    words = newWords;
+}
+
+uint32 BlockStorage::get_bits_per_block() const noexcept {
+    return bitsPerBlock;
+}
+
+uint32 BlockStorage::get_palette_size() const noexcept {
+    return static_cast<uint32>(palette.size());
+}
+
+bool BlockStorage::is_compressed() const noexcept {
+    return runs != nullptr;
+}
+
+size_t BlockStorage::get_memory_usage() const noexcept {
+    if (runs) {
+        return sizeof(*this) + palette.capacity() * sizeof(Block)
+                + numRuns * sizeof(uint32);
+    }
+
+    return sizeof(*this) + palette.capacity() * sizeof(Block)
+            + get_num_words(numBlocks, bitsPerBlock) * sizeof(uint64);
+}
+
+BlockStorage::~BlockStorage() {
+    free_words(words, get_num_words(numBlocks, bitsPerBlock));
+    free_runs();
+}
+
+uint32 BlockStorage::find_in_palette(const Block& block) const noexcept {
+    uint32 i = 0;
+
+    for (; i < palette.size(); ++i) {
+        if (is_same_block(palette[i], block)) {
+            break;
+        }
+    }
+
+    return i;
+}
+
+uint32 BlockStorage::get_palette_index(uint32 index) const noexcept {
+    if (runs) {
+        // the first run that ends past index
+        const uint32 key = (index << RUN_PALETTE_BITS) | RUN_PALETTE_MASK;
+
+        return *std::upper_bound(runs, runs + numRuns, key) & RUN_PALETTE_MASK;
+    }
+
+    if (bitsPerBlock == 0) {
+        return 0;
+    }
+
+    return read_index(words, bitsPerBlock, index);
+}
+
+void BlockStorage::set_palette_index(uint32 index,
+        uint32 paletteIndex) noexcept {
+    if (bitsPerBlock > 0) {
+        write_index(words, bitsPerBlock, index, paletteIndex);
+    }
+}
+
+void BlockStorage::set_bits_per_block(uint32 newBits, const uint32* remap) {
+    uint64* newWords = allocate_words(get_num_words(numBlocks, newBits));
+
+    if (newBits > 0) {
+        for (uint32 i = 0; i < numBlocks; ++i) {
+            const uint32 paletteIndex = get_palette_index(i);
+
+            write_index(newWords, newBits, i,
+                    remap != nullptr ? remap[paletteIndex] : paletteIndex);
+        }
+    }
+
+    free_words(words, get_num_words(numBlocks, bitsPerBlock));
+
+    words = newWords;
+    bitsPerBlock = newBits;
+}
+
+void BlockStorage::expand_runs(uint64* words) const {
+    uint32 begin = 0;
+
+    for (uint32 j = 0; j < numRuns; ++j) {
+        const uint32 run = runs[j];
+        const uint32 end = run >> RUN_PALETTE_BITS;
+
+        for (uint32 i = begin; i < end; ++i) {
+            write_index(words, bitsPerBlock, i, run & RUN_PALETTE_MASK);
+        }
+
+        begin = end;
+    }
+}
+
+void BlockStorage::free_runs() noexcept {
+    if (runs) {
+        Memory::free(runs);
+
+        runs = nullptr;
+        numRuns = 0;
+    }
+}
@@ -0,0 +1,111 @@
+#pragma once
+
+#include <engine/core/common.hpp>
+#include <engine/core/array-list.hpp>
+
+#include <atomic>
+
+#include "block.hpp"
+
+// Blocks of one chunk stored as indices into a palette of the distinct
+// blocks it holds. Indices are packed into 64 bit words at 0, 1, 2, 4 or 8
+// bits per block, 16 only once a chunk holds more than 256 distinct blocks.
+// The width grows when set() runs out of palette entries and shrinks again
+// when repack() drops the entries no block refers to anymore. A width of 0
+// keeps a single block for the whole chunk and no index words at all.
+//
+// Storages and their index words come from a slab shared by every chunk,
+// index words in one size class per width, and go back to it on release,
+// so streaming chunks in and out does not allocate once the slab has grown
+// to the working set. The OS pages under the words compress() frees are
+// handed back to the OS once no other words are left on them.
+//
+// compress() swaps the index words for runs of equal indices in storage
+// order, which terrain has few of. Reads work on the runs directly, get()
+// with a binary search over them, and the first set() expands them back.
+//
+// Storages are reference counted so a chunk can hand its current blocks to
+// a mesher as an immutable snapshot. Whoever changes a shared storage
+// copies it first, see Chunk::getWritableBlocks().
+class BlockStorage {
+    public:
+        explicit BlockStorage(uint32 numBlocks);
+
+        // acquire() hands out storages with one reference, release() drops
+        // one and returns the storage to the slab with the last
+        static BlockStorage* acquire(uint32 numBlocks);
+        static void release(BlockStorage* storage);
+
+        void add_reference() noexcept;
+        // set while anyone but the owner holds a reference, the storage must
+        // not change then
+        bool is_shared() const noexcept;
+
+        Block get(uint32 index) const noexcept;
+        void set(uint32 index, const Block& block);
+
+        void fill(const Block& block);
+        // palette[indices[i]] becomes block i, unused entries are dropped
+        void assign(const Block* palette, uint32 paletteSize,
+                const uint8* indices);
+        // copies the blocks of other, compressed if other is
+        void assign(const BlockStorage& other);
+
+        // writes every block in index order, the mesher decodes a whole
+        // chunk at once instead of calling get() per block
+        void decode(Block* blocks) const;
+
+        // drops palette entries no block refers to and narrows the indices
+        // to the smallest width that still fits
+        void repack();
+
+        // returns false and keeps the index words when the runs would not
+        // take less memory than they do
+        bool compress();
+        void decompress();
+
+        // appends the palette and the packed indices to data in the byte
+        // order of the machine, which only has to read it back itself
+        void write(ArrayList<uint8>& data) const;
+        // replaces the blocks with ones written by write(), returns false
+        // and leaves the storage as it was when the data is malformed
+        bool read(const uint8* data, size_t size);
+
+        // width of the indices, also while they are compressed
+        uint32 get_bits_per_block() const noexcept;
+        uint32 get_palette_size() const noexcept;
+        bool is_compressed() const noexcept;
+
+        // heap and inline bytes held by the storage
+        size_t get_memory_usage() const noexcept;
+
+        ~BlockStorage();
+    private:
+        NULL_COPY_AND_ASSIGN(BlockStorage);
+
+        ArrayList<Block> palette;
+        // null while bitsPerBlock is 0 or the storage is compressed
+        uint64* words;
+        // one past the last index of each run above RUN_PALETTE_BITS, the
+        // palette index below, null unless compressed
+        uint32* runs;
+
+        uint32 numBlocks;
+        uint32 bitsPerBlock;
+        uint32 numRuns;
+
+        std::atomic<uint32> numReferences;
+
+        uint32 find_in_palette(const Block& block) const noexcept;
+
+        uint32 get_palette_index(uint32 index) const noexcept;
+        void set_palette_index(uint32 index, uint32 paletteIndex) noexcept;
+
+        // moves the indices into words of the new width, remapping them
+        // through remap when one is given
+        void set_bits_per_block(uint32 newBits, const uint32* remap = nullptr);
+
+        // writes the indices held by the runs into words of bitsPerBlock
+        void expand_runs(uint64* words) const;
+        void free_runs() noexcept;
+};
@@ -16,33 +16,9 @@ BlockTreeNode::BlockTreeNode(const Vector3f& minExtents,
 		, level(level)
 		, maxLevel(maxLevel)
 		, parent(parent)
-		, empty(true) {
-	if (level < maxLevel) {
-		data = Memory::malloc(sizeof(ChildData));
-		ChildData* cd = static_cast<ChildData*>(data);
-
-		Memory::memset(cd->children, 0, 8 * sizeof(BlockTreeNode*));
-
-		const Vector3f center = aabb.getCenter();
-		const Vector3f extents = aabb.getExtents();
-
-		int32 i = 0;
-
-		for (float z = -1.f; z <= 1.f; z += 2.f) {
-			for (float y = -1.f; y <= 1.f; y += 2.f) {
-				for (float x = -1.f; x <= 1.f; x += 2.f) {
-					const Vector3f corner = center + extents * Vector3f(x, y, z);
-
-					cd->childAABBs[i++] = AABB(Math::min(center, corner),
-							Math::max(center, corner));
-				}
-			}
-		}
-	}
-	else {
-		data = nullptr;
-	}
-}
+		, data(nullptr)
+		, empty(true)
+		, full(false) {}
 
 bool BlockTreeNode::intersectsRay(const Vector3f& origin,
 		const Vector3f& direction, Vector3i& intersectCoord,
@@ -62,8 +38,17 @@ bool BlockTreeNode::intersectsRay(const Vector3f& origin,
 			}
 		}
 
+		if (full) {
+			return intersectsFullRay(origin, direction, p1, p2,
+					intersectCoord, intersectPos);
+		}
+
 		ChildData* cd = static_cast<ChildData*>(data);
 
+		if (!cd) {
+			return false;
+		}
+
 		Vector3i tempCoord;
 		Vector3f tempPos;
 
@@ -98,13 +83,13 @@ bool BlockTreeNode::add(const Vector3i& position) {
 		return false;
 	}
 	
-	if (level == maxLevel) {
+	if (level == maxLevel || full) {
 		empty = false;
 
 		return true;
 	}
 
-	ChildData* cd = reinterpret_cast<ChildData*>(data);
+	ChildData* cd = getChildData();
 
 	for (int32 i = 0; i < 8; ++i) {
 		if (cd->childAABBs[i].contains(position)) {
@@ -137,6 +122,10 @@ bool BlockTreeNode::remove(const Vector3i& position) {
 		return true;
 	}
 
+	if (full) {
+		split();
+	}
+
 	ChildData* cd = reinterpret_cast<ChildData*>(data);
 
 	bool removed = false;
@@ -171,31 +160,115 @@ bool BlockTreeNode::remove(const Vector3i& position) {
 	return removed;
 }
 
+void BlockTreeNode::fill() {
+	clear();
+
+	empty = false;
+	full = level < maxLevel;
+}
+
 void BlockTreeNode::clear() {
-	ChildData* cd = reinterpret_cast<ChildData*>(data);
+	empty = true;
+	full = false;
 
-	for (int32 i = 0; i < 8; ++i) {
-		if (cd->children[i]) {
-			delete cd->children[i];
-			cd->children[i] = nullptr;
+	freeChildData();
+}
+
+bool BlockTreeNode::intersectsFullRay(const Vector3f& origin,
+		const Vector3f& direction, float entry, float exit,
+		Vector3i& intersectCoord, Vector3f& intersectPos) const {
+	// like the leaves, skip the block the ray starts in and hit the next one
+	if (entry <= 0.f) {
+		const Vector3f cell = Math::floor(origin + Vector3f(0.5f));
+		float cellEntry;
+
+		AABB(cell - Vector3f(0.5f), cell + Vector3f(0.5f))
+				.intersectsRay(origin, direction, cellEntry, entry);
+
+		if (entry >= exit) {
+			return false;
 		}
 	}
+
+	intersectPos = origin + direction * entry;
+
+	// nudge the hit point into the block being entered
+	const Vector3f inside = intersectPos + direction * 1e-3f
+			+ Vector3f(0.5f);
+	const Vector3f minExtents = aabb.getMinExtents();
+	const Vector3f maxExtents = aabb.getMaxExtents();
+
+	for (int32 i = 0; i < 3; ++i) {
+		intersectCoord[i] = Math::clamp(static_cast<int32>(inside[i]),
+				static_cast<int32>(minExtents[i] + 0.5f),
+				static_cast<int32>(maxExtents[i] - 0.5f));
+	}
+
+	return true;
 }
 
-BlockTreeNode** BlockTreeNode::getChildren() {
-	return reinterpret_cast<ChildData*>(data)->children;
+void BlockTreeNode::split() {
+	ChildData* cd = getChildData();
+
+	for (int32 i = 0; i < 8; ++i) {
+		cd->children[i] = new BlockTreeNode(cd->childAABBs[i].getMinExtents(),
+				cd->childAABBs[i].getMaxExtents(), maxLevel, level + 1, this);
+		cd->children[i]->fill();
+	}
+
+	full = false;
 }
 
-BlockTreeNode::~BlockTreeNode() {
-	if (level < maxLevel) {
-		ChildData* cd = static_cast<ChildData*>(data);
+BlockTreeNode::ChildData* BlockTreeNode::getChildData() {
+	if (data) {
+		return static_cast<ChildData*>(data);
+	}
 
-		for (int32 i = 0; i < 8; ++i) {
-			if (cd->children[i]) {
-				delete cd->children[i];
+	data = Memory::malloc(sizeof(ChildData));
+	ChildData* cd = static_cast<ChildData*>(data);
+
+	Memory::memset(cd->children, 0, 8 * sizeof(BlockTreeNode*));
+
+	const Vector3f center = aabb.getCenter();
+	const Vector3f extents = aabb.getExtents();
+
+	int32 i = 0;
+
+	for (float z = -1.f; z <= 1.f; z += 2.f) {
+		for (float y = -1.f; y <= 1.f; y += 2.f) {
+			for (float x = -1.f; x <= 1.f; x += 2.f) {
+				const Vector3f corner = center + extents * Vector3f(x, y, z);
+
+				cd->childAABBs[i++] = AABB(Math::min(center, corner),
+						Math::max(center, corner));
 			}
 		}
+	}
+
+	return cd;
+}
 
-		Memory::free(data);
+void BlockTreeNode::freeChildData() {
+	if (!data) {
+		return;
 	}
+
+	ChildData* cd = static_cast<ChildData*>(data);
+
+	for (int32 i = 0; i < 8; ++i) {
+		if (cd->children[i]) {
+			delete cd->children[i];
+		}
+	}
+
+	Memory::free(data);
+	data = nullptr;
+}
+
+BlockTreeNode** BlockTreeNode::getChildren() {
+	return data ? static_cast<ChildData*>(data)->children : nullptr;
+}
+
+BlockTreeNode::~BlockTreeNode() {
+	freeChildData();
 }
@@ -16,6 +16,9 @@ class BlockTreeNode {
 		bool add(const Vector3i& position);
 		bool remove(const Vector3i& position);
 
+		// marks every block in the node as solid without creating children,
+		// they are only created once a block is removed again
+		void fill();
 		void clear();
 
 		inline const AABB& getAABB() const { return aabb; }
@@ -39,8 +42,21 @@ class BlockTreeNode {
 		int32 maxLevel;
 
 		BlockTreeNode* parent;
+
+		// ChildData of interior nodes, only allocated once the node gets
+		// children so empty chunks hold no tree memory
 		void* data;
 
 		bool empty;
+		bool full;
+
+		bool intersectsFullRay(const Vector3f& origin,
+				const Vector3f& direction, float entry, float exit,
+				Vector3i& intersectCoord, Vector3f& intersectPos) const;
+
+		void split();
+
+		ChildData* getChildData();
+		void freeChildData();
 };
 
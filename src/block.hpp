@@ -2,13 +2,15 @@
 
 #include <engine/math/vector.hpp>
 
+// ids of the types the code refers to by name, registered by BlockRegistry
+// before the ones it loads, which continue from NUM_BUILTIN_TYPES
 enum class BlockType : uint16 {
     AIR = 0,
     GRASS,
     DIRT,
     STONE,
 
-    NUM_TYPES
+    NUM_BUILTIN_TYPES
 };
 
 enum class Side {
@@ -24,11 +26,13 @@ enum class Side {
 
 class Block {
     public:
-        static Vector3f get_color(const BlockType type) noexcept;
-
         inline Block() noexcept
                 : active(false)
                 , type(BlockType::AIR) {}
+
+        inline Block(bool active, BlockType type) noexcept
+                : active(active)
+                , type(type) {}
         
         inline void set_active(bool active) noexcept {
             this->active = active;
@@ -1,12 +1,26 @@
 #include "chunk-builder.hpp"
 
 #include <engine/math/matrix.hpp>
+#include <engine/math/math.hpp>
 
 #include <engine/rendering/vertex-array.hpp>
 
+#include "block-registry.hpp"
 #include "chunk.hpp"
 
 namespace {
+    // corners run from 0 to CHUNK_SIZE inclusive
+    constexpr const uint32 POSITION_BITS = Chunk::CHUNK_SIZE_SHIFT + 1;
+    constexpr const uint32 SIDE_SHIFT = 3 * POSITION_BITS;
+    constexpr const uint32 SIDE_BITS = 3;
+    constexpr const uint32 AO_SHIFT = SIDE_SHIFT + SIDE_BITS;
+    constexpr const uint32 AO_BITS = 2;
+
+    static_assert(AO_SHIFT + AO_BITS <= 32,
+            "the packed vertex must fit in a single uint32");
+
+    constexpr const size_t ROWS_PER_TYPE = Chunk::CHUNK_SIZE * Chunk::CHUNK_SIZE;
+
     constexpr Vector3f get_normal(const Side side) {
         switch (side) {
             case Side::SIDE_BACK:
@@ -21,47 +35,115 @@ namespace {
                 return Vector3f(0, -1, 0);
             case Side::SIDE_TOP:
                 return Vector3f(0, 1, 0);
+            case Side::NUM_SIDES:
+                break;
         }
 
         return Vector3f();
     }
+
+    // scratch is sized on first use and kept across clear()
+    template <typename T>
+    T* get_scratch(ArrayList<T>& scratch, size_t size) {
+        if (scratch.empty()) {
+            scratch.resize(size);
+        }
+
+        return scratch.data();
+    }
 };
 
-void ChunkBuilder::add_quad(const Vector3f& v0, const Vector3f& v1,
-        const Vector3f& v2, const Vector3f& v3,
-        const Block& block, Side side, bool backFace) {
-    constexpr const Vector3f STATIC_OFFSET = Vector3f(Chunk::BLOCK_RENDER_SIZE);
+ChunkVertex ChunkBuilder::pack_vertex(const Vector3i& position, Side side,
+        uint32 ao, BlockType type) {
+    return {static_cast<uint32>(position.x)
+            | (static_cast<uint32>(position.y) << POSITION_BITS)
+            | (static_cast<uint32>(position.z) << (2 * POSITION_BITS))
+            | (static_cast<uint32>(side) << SIDE_SHIFT)
+            | (ao << AO_SHIFT), static_cast<uint32>(type)};
+}
+
+void ChunkBuilder::unpack_vertex(const ChunkVertex& vertex,
+        Vector3f& position, Vector3f& normal, Vector3f& color, uint32& ao) {
+    constexpr const uint32 POSITION_MASK = (1 << POSITION_BITS) - 1;
+    constexpr const uint32 SIDE_MASK = (1 << SIDE_BITS) - 1;
+    constexpr const uint32 AO_MASK = (1 << AO_BITS) - 1;
 
-    const uint32 baseIndex = positions.size();
+    const uint32 packed = vertex.packed;
+
+    position = Vector3f(packed & POSITION_MASK,
+            (packed >> POSITION_BITS) & POSITION_MASK,
+            (packed >> (2 * POSITION_BITS)) & POSITION_MASK)
+            - Vector3f(Chunk::BLOCK_RENDER_SIZE);
+    normal = get_normal(static_cast<Side>((packed >> SIDE_SHIFT) & SIDE_MASK));
+    color = BlockRegistry::getInstance().get_color(
+            static_cast<BlockType>(vertex.type));
+    ao = (packed >> AO_SHIFT) & AO_MASK;
+}
 
-    positions.push_back(v0 - STATIC_OFFSET);
-    positions.push_back(v3 - STATIC_OFFSET);
-    positions.push_back(v1 - STATIC_OFFSET);
-    positions.push_back(v2  - STATIC_OFFSET);
+void ChunkBuilder::build_quad_indices(IndexedModel& model) {
+    // a chunk in a 3D checkerboard shows all six faces of half its blocks
+    constexpr const uint32 MAX_QUADS = Chunk::CHUNK_SIZE * Chunk::CHUNK_SIZE
+            * Chunk::CHUNK_SIZE * 3;
 
-    for (uint32 i = 0; i < 4; ++i) {
-        normals.push_back(get_normal(side)); // TODO: get normal from block face
-        colors.push_back(Block::get_color(block.get_type()));
+    for (uint32 i = 0, baseIndex = 0; i < MAX_QUADS; ++i, baseIndex += 4) {
+        model.addIndices3i(baseIndex + 2, baseIndex, baseIndex + 1);
+        model.addIndices3i(baseIndex + 1, baseIndex + 3, baseIndex + 2);
     }
+}
 
-    if (backFace) {
-        indices.push_back(baseIndex + 2);
-        indices.push_back(baseIndex);
-        indices.push_back(baseIndex + 1);
+uint32 ChunkBuilder::get_max_block_types() {
+    // the vertex holds any type id, BlockType is the narrower of the two
+    return uint32(1) << (8 * sizeof(BlockType));
+}
+
+String ChunkBuilder::get_shader_defines() {
+    return "#define CHUNK_POSITION_BITS " + std::to_string(POSITION_BITS)
+            + "u\n";
+}
+
+void ChunkBuilder::add_quad(const Vector3i& v0, const Vector3i& v1,
+        const Vector3i& v2, const Vector3i& v3,
+        BlockType type, Side side, bool backFace, uint32 ao) {
+    const uint32 a0 = ao & 3;
+    const uint32 a1 = (ao >> 2) & 3;
+    const uint32 a2 = (ao >> 4) & 3;
+    const uint32 a3 = (ao >> 6) & 3;
+
+    // the shared indices split quads along v1-v3, rotating the corners
+    // splits along v0-v2 instead, which keeps AO gradients symmetric
+    if (a0 + a2 < a1 + a3) {
+        add_quad(v1, v2, v3, v0, type, side, backFace,
+                a1 | (a2 << 2) | (a3 << 4) | (a0 << 6));
+        return;
+    }
+
+    if (vertices.size() + 4 > vertices.capacity()) {
+        ++numAllocations;
+    }
 
-        indices.push_back(baseIndex + 1);
-        indices.push_back(baseIndex + 3);
-        indices.push_back(baseIndex + 2);
+    // front faces are reordered so the shared indices keep their winding
+    if (backFace) {
+        vertices.push_back(pack_vertex(v0, side, a0, type));
+        vertices.push_back(pack_vertex(v3, side, a3, type));
+        vertices.push_back(pack_vertex(v1, side, a1, type));
+        vertices.push_back(pack_vertex(v2, side, a2, type));
     }
     else {
-        indices.push_back(baseIndex + 2);
-        indices.push_back(baseIndex + 3);
-        indices.push_back(baseIndex + 1);
+        vertices.push_back(pack_vertex(v2, side, a2, type));
+        vertices.push_back(pack_vertex(v3, side, a3, type));
+        vertices.push_back(pack_vertex(v1, side, a1, type));
+        vertices.push_back(pack_vertex(v0, side, a0, type));
+    }
+}
 
-        indices.push_back(baseIndex + 1);
-        indices.push_back(baseIndex);
-        indices.push_back(baseIndex + 2);
-    }   
+void ChunkBuilder::add_vertices(const ChunkVertex* vertices,
+        size_t numVertices) {
+    if (this->vertices.size() + numVertices > this->vertices.capacity()) {
+        ++numAllocations;
+    }
+
+    this->vertices.insert(std::end(this->vertices), vertices,
+            vertices + numVertices);
 }
 
 void ChunkBuilder::fill_buffers() {
@@ -71,24 +153,153 @@ void ChunkBuilder::fill_buffers() {
             * static_cast<float>(Chunk::CHUNK_SIZE);
 
     auto& vao = chunk->getVertexArray();
+    const auto& mesh = chunk->meshVertices;
+
+    const uint32 numVertices = static_cast<uint32>(mesh.size());
+    const uint32 end = Math::min(chunk->uploadEnd, numVertices);
+
+    if (numVertices * sizeof(ChunkVertex) > vao.getBufferSize(0)) {
+        numUploadedBytes = numVertices * sizeof(ChunkVertex);
+        vao.updateBuffer(0, mesh.data(), numUploadedBytes);
+    }
+    else if (chunk->uploadBegin < end) {
+        numUploadedBytes = (end - chunk->uploadBegin) * sizeof(ChunkVertex);
+        vao.updateBufferRange(0, mesh.data() + chunk->uploadBegin,
+                chunk->uploadBegin * sizeof(ChunkVertex), numUploadedBytes);
+    }
+
+    chunk->uploadBegin = UINT32_MAX;
+    chunk->uploadEnd = 0;
+
+    vao.updateBuffer(1, &pos, sizeof(Vector3f));
+    vao.setNumElements(numVertices / 4 * INDICES_PER_QUAD);
 
-    vao.updateBuffer(0, positions.data(), positions.size() * sizeof(Vector3f));
-    vao.updateBuffer(1, normals.data(), normals.size() * sizeof(Vector3f));
-    vao.updateBuffer(2, colors.data(), colors.size() * sizeof(Vector3f));
-    vao.updateBuffer(3, &pos, sizeof(Vector3f));
-    vao.updateIndices(indices.data(), indices.size());
+    editTime = chunk->meshedEditTime;
+    chunk->meshedEditTime = -1.0;
 
     chunk->setRebuilt();
 }
 
-void ChunkBuilder::set_chunk(Chunk* chunk) {
+void ChunkBuilder::clear() {
+    vertices.clear();
+    numPlainQuads = 0;
+    numAllocations = 0;
+    numUploadedBytes = 0;
+    editTime = -1.0;
+    chunk = nullptr;
+    generation = 0;
+}
+
+void ChunkBuilder::set_chunk(Chunk* chunk, uint32 generation) {
     this->chunk = chunk;
+    this->generation = generation;
+}
+
+Chunk* ChunkBuilder::get_chunk() const {
+    return chunk;
+}
+
+uint32 ChunkBuilder::get_generation() const {
+    return generation;
 }
 
 bool ChunkBuilder::is_empty() const {
-    return positions.empty();
+    return vertices.empty();
+}
+
+bool ChunkBuilder::has_same_geometry(const ChunkBuilder& other) const {
+    return vertices == other.vertices;
 }
 
 size_t ChunkBuilder::num_vertices() const {
-    return positions.size();
+    return vertices.size();
+}
+
+size_t ChunkBuilder::num_indices() const {
+    return vertices.size() / 4 * INDICES_PER_QUAD;
+}
+
+size_t ChunkBuilder::num_quads() const {
+    return vertices.size() / 4;
+}
+
+void ChunkBuilder::set_num_plain_quads(size_t numPlainQuads) {
+    this->numPlainQuads = numPlainQuads;
+}
+
+size_t ChunkBuilder::num_plain_quads() const {
+    return numPlainQuads;
+}
+
+size_t ChunkBuilder::num_allocations() const {
+    return numAllocations;
+}
+
+void ChunkBuilder::add_allocation() {
+    ++numAllocations;
+}
+
+size_t ChunkBuilder::num_uploaded_bytes() const {
+    return numUploadedBytes;
+}
+
+double ChunkBuilder::get_edit_time() const {
+    return editTime;
+}
+
+const ArrayList<ChunkVertex>& ChunkBuilder::get_vertices() const {
+    return vertices;
+}
+
+Block* ChunkBuilder::get_block_grid() {
+    return get_scratch(blockGrid, Chunk::NUM_BLOCKS);
+}
+
+uint64* ChunkBuilder::get_column_grid() {
+    return get_scratch(columnGrid, 6 * ROWS_PER_TYPE);
+}
+
+uint64* ChunkBuilder::get_face_rows() {
+    return get_scratch(faceRows, ROWS_PER_TYPE);
+}
+
+uint8* ChunkBuilder::get_occlusion_grid() {
+    return get_scratch(occlusionGrid, Chunk::NUM_BLOCKS);
+}
+
+BlockType* ChunkBuilder::get_cell_grid() {
+    return get_scratch(cellGrid, Chunk::NUM_BLOCKS / 8);
+}
+
+Block* ChunkBuilder::get_face_mask() {
+    return get_scratch(faceMask, ROWS_PER_TYPE);
+}
+
+void ChunkBuilder::reset_type_slots() {
+    for (const BlockType type : slotTypes) {
+        typeSlots[static_cast<uint32>(type)] = NO_TYPE_SLOT;
+    }
+
+    slotTypes.clear();
+}
+
+uint32 ChunkBuilder::add_type_slot(BlockType type) {
+    const uint32 index = static_cast<uint32>(type);
+    const uint32 slot = static_cast<uint32>(slotTypes.size());
+
+    if (index >= typeSlots.size()) {
+        typeSlots.resize(index + 1, NO_TYPE_SLOT);
+    }
+
+    if (typeRows.size() < (slot + 1) * ROWS_PER_TYPE) {
+        typeRows.resize((slot + 1) * ROWS_PER_TYPE);
+    }
+
+    Memory::memset(typeRows.data() + slot * ROWS_PER_TYPE, 0,
+            ROWS_PER_TYPE * sizeof(uint64));
+
+    typeSlots[index] = slot;
+    slotTypes.push_back(type);
+
+    return slot;
 }
@@ -2,35 +2,158 @@
 
 #include <engine/core/common.hpp>
 #include <engine/core/array-list.hpp>
+#include <engine/core/string.hpp>
 
 #include <engine/math/vector.hpp>
 
+#include "block.hpp"
+
 class Chunk;
-class Block;
-enum class Side;
+class IndexedModel;
+
+// Chunk vertices are a ChunkVertex, decoded again in basic-shader.glsl. The
+// first uint32 packs, from the lowest bit up:
+//     corner position in blocks, log2(CHUNK_SIZE) + 1 bits per axis
+//     Side of the face, 3 bits
+//     ambient occlusion, 2 bits, 0 is fully occluded
+// the second holds the BlockType, so every chunk size takes the same type
+// ids, see get_max_block_types().
+// The shader gets the position width from get_shader_defines().
+// Every quad is emitted in the same winding order, so all chunk meshes draw
+// from one shared index buffer built by build_quad_indices().
+struct ChunkVertex {
+    uint32 packed;
+    uint32 type;
+
+    inline bool operator==(const ChunkVertex& other) const noexcept {
+        return packed == other.packed && type == other.type;
+    }
+};
 
 class ChunkBuilder {
     public:
+        // quad AO is 2 bits per corner in add_quad() order
+        static constexpr const uint32 AO_NONE = 0xFF;
+
+        static constexpr const uint32 INDICES_PER_QUAD = 6;
+
         ChunkBuilder() = default;
 
-        void add_quad(const Vector3f& v0, const Vector3f& v1,
-                const Vector3f& v2, const Vector3f& v3,
-                const Block& block, Side side, bool backFace);
+        static ChunkVertex pack_vertex(const Vector3i& position, Side side,
+                uint32 ao, BlockType type);
+        static void unpack_vertex(const ChunkVertex& vertex, Vector3f& position,
+                Vector3f& normal, Vector3f& color, uint32& ao);
 
+        static void build_quad_indices(IndexedModel& model);
+
+        // number of block type ids the vertex layout of this build holds
+        static uint32 get_max_block_types();
+
+        // defines basic-shader.glsl needs to unpack vertices of this build
+        static String get_shader_defines();
+
+        void add_quad(const Vector3i& v0, const Vector3i& v1,
+                const Vector3i& v2, const Vector3i& v3,
+                BlockType type, Side side, bool backFace,
+                uint32 ao = AO_NONE);
+        void add_vertices(const ChunkVertex* vertices, size_t numVertices);
+
+        // uploads the part of the chunk mesh that changed since the last
+        // upload, which may already include later rebuilds of the chunk
         void fill_buffers();
 
-        void set_chunk(Chunk* chunk);
+        // resets the builder for reuse without releasing vertex capacity
+        void clear();
+
+        // the chunk meshed and its generation at the time, see
+        // Chunk::moveTo()
+        void set_chunk(Chunk* chunk, uint32 generation);
+        Chunk* get_chunk() const;
+        uint32 get_generation() const;
 
         bool is_empty() const;
+        bool has_same_geometry(const ChunkBuilder& other) const;
 
         size_t num_vertices() const;
+        size_t num_indices() const;
+        size_t num_quads() const;
+
+        void set_num_plain_quads(size_t numPlainQuads);
+        size_t num_plain_quads() const;
+
+        // vertex buffer growths since the last clear(), including those of
+        // the mesh copy the chunk keeps, see Chunk::commitMesh()
+        size_t num_allocations() const;
+        void add_allocation();
+
+        // bytes sent by fill_buffers() and the time of the oldest block
+        // edit it made visible, negative when it carried none
+        size_t num_uploaded_bytes() const;
+        double get_edit_time() const;
+
+        const ArrayList<ChunkVertex>& get_vertices() const;
+
+        // scratch for the decoded blocks of the chunk being meshed, kept
+        // off the worker stacks, which it would strain at CHUNK_SIZE 64
+        Block* get_block_grid();
+
+        // more meshing scratch kept off the worker stacks: the bit columns
+        // of the binary mesher, 6 * CHUNK_SIZE^2 for its meshed and opaque
+        // cells along each axis, its CHUNK_SIZE^2 face rows, the corner AO
+        // of one face per block and the cell types of a LOD mesh, and the
+        // CHUNK_SIZE^2 face mask of the mask mesher
+        uint64* get_column_grid();
+        uint64* get_face_rows();
+        uint8* get_occlusion_grid();
+        BlockType* get_cell_grid();
+        Block* get_face_mask();
+
+        // chunk local slots for the block types the binary mesher finds on
+        // one side, handed out in the order they show up. The face rows it
+        // clears and merges scale with the types on the side rather than
+        // with every registered type
+        uint32 get_type_slot(BlockType type);
+        // CHUNK_SIZE^2 face rows per slot, each cleared when its slot is
+        // handed out, moves when a new slot is
+        uint64* get_type_rows() noexcept;
+        void reset_type_slots();
     private:
         NULL_COPY_AND_ASSIGN(ChunkBuilder);
 
-        ArrayList<Vector3f> positions;
-        ArrayList<Vector3f> normals;
-        ArrayList<Vector3f> colors;
-        ArrayList<uint32> indices;
+        static constexpr const uint32 NO_TYPE_SLOT = UINT32_MAX;
 
-        Chunk* chunk;
+        ArrayList<ChunkVertex> vertices;
+        ArrayList<Block> blockGrid;
+        ArrayList<uint64> columnGrid;
+        ArrayList<uint64> faceRows;
+        ArrayList<uint8> occlusionGrid;
+        ArrayList<BlockType> cellGrid;
+        ArrayList<Block> faceMask;
+        // slot by type id, NO_TYPE_SLOT while the type has none
+        ArrayList<uint32> typeSlots;
+        ArrayList<BlockType> slotTypes;
+        ArrayList<uint64> typeRows;
+        size_t numPlainQuads = 0;
+        size_t numAllocations = 0;
+        size_t numUploadedBytes = 0;
+        double editTime = -1.0;
+
+        Chunk* chunk = nullptr;
+        uint32 generation = 0;
+
+        uint32 add_type_slot(BlockType type);
 };
+
+inline uint32 ChunkBuilder::get_type_slot(BlockType type) {
+    const uint32 index = static_cast<uint32>(type);
+
+    if (index < typeSlots.size() && typeSlots[index] != NO_TYPE_SLOT) {
+        return typeSlots[index];
+    }
+
+    return add_type_slot(type);
+}
+
+inline uint64* ChunkBuilder::get_type_rows() noexcept {
+    return typeRows.data();
+}
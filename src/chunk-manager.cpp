@@ -1,43 +1,169 @@
 #include "chunk-manager.hpp"
 
 #include <engine/core/memory.hpp>
+#include <engine/core/time.hpp>
 
 #include <engine/math/matrix.hpp>
 #include <engine/math/math.hpp>
 
 #include <engine/rendering/vertex-array.hpp>
 
+#include <algorithm>
+
+#include "block-registry.hpp"
 #include "chunk.hpp"
+#include "chunk-builder.hpp"
 #include "camera.hpp"
 
 #define CUBE(n) ((n) * (n) * (n))
 
-#define NUM_THREADS             1
-#define MAX_CHUNKS_TO_REBUILD   8
+#define NUM_CHUNK_BUILDERS      32
+
+#define NUM_SIDES               static_cast<int32>(Side::NUM_SIDES)
+#define ALL_SIDES               ((1 << NUM_SIDES) - 1)
+
+namespace {
+    // saved chunks the load cube reaches within this many seconds at the
+    // current camera velocity are read ahead
+    constexpr const float PREFETCH_TIME = 1.f;
+    // weight of the latest frame in the smoothed camera velocity
+    constexpr const float VELOCITY_SMOOTHING = 0.25f;
+
+    // chunks outside the frustum are queued as if they were this many times
+    // further away, so the ones behind the camera still come before the
+    // far ones in sight
+    constexpr const uint32 HIDDEN_DISTANCE_SCALE = 2;
+    // queued chunks are sorted again once the camera turns by more than
+    // 15 degrees, this is the cosine
+    constexpr const float MAX_TURN_COS = 0.966f;
+
+    constexpr const uint32 NOT_QUEUED = UINT32_MAX;
+
+    // what update() uploads per frame until set_upload_budget() says
+    // otherwise
+    constexpr const size_t DEFAULT_MAX_UPLOAD_BYTES = 1 << 20;
+    constexpr const double DEFAULT_MAX_UPLOAD_TIME = 0.002;
+
+    // indexed by Side, the opposite of side i is always i ^ 1
+    constexpr const Vector3i SIDE_OFFSETS[] = {Vector3i(0, 0, -1),
+            Vector3i(0, 0, 1), Vector3i(-1, 0, 0), Vector3i(1, 0, 0),
+            Vector3i(0, 1, 0), Vector3i(0, -1, 0)};
+
+    bool has_solid_rows(const uint64* rows) {
+        uint64 any = 0;
+
+        for (int32 i = 0; i < Chunk::CHUNK_SIZE; ++i) {
+            any |= rows[i];
+        }
+
+        return any != 0;
+    }
+
+    // the shift rounds negative positions down to the chunk holding them
+    void split_block_position(const Vector3i& position, Vector3i& chunkPos,
+            Vector3i& blockPos) {
+        constexpr const int32 MASK = Chunk::CHUNK_SIZE - 1;
+
+        for (int32 i = 0; i < 3; ++i) {
+            chunkPos[i] = position[i] >> Chunk::CHUNK_SIZE_SHIFT;
+            blockPos[i] = position[i] & MASK;
+        }
+    }
+
+    // the main thread keeps a core of its own where there is one to spare
+    uint32 get_num_workers(uint32 numWorkers) {
+        if (numWorkers > 0) {
+            return numWorkers;
+        }
+
+        return Math::max(std::thread::hardware_concurrency(), 2u) - 1;
+    }
+
+    uint32 get_border_sides(const Vector3i& blockPos) {
+        constexpr const int32 LAST = Chunk::CHUNK_SIZE - 1;
+
+        return ((blockPos.z == 0) << static_cast<int32>(Side::SIDE_BACK))
+                | ((blockPos.z == LAST) << static_cast<int32>(Side::SIDE_FRONT))
+                | ((blockPos.x == 0) << static_cast<int32>(Side::SIDE_LEFT))
+                | ((blockPos.x == LAST) << static_cast<int32>(Side::SIDE_RIGHT))
+                | ((blockPos.y == LAST) << static_cast<int32>(Side::SIDE_TOP))
+                | ((blockPos.y == 0) << static_cast<int32>(Side::SIDE_BOTTOM));
+    }
+};
 
-ChunkManager::ChunkManager(RenderContext& context, int32 loadDistance)
+ChunkManager::ChunkManager(RenderContext& context, int32 loadDistance,
+        const String& saveDirectory, uint32 numWorkers)
         : chunkPool((Chunk*)Memory::malloc(CUBE(loadDistance) * sizeof(Chunk)))
+        , quadIndices(nullptr)
         , loadedChunks((Chunk**)Memory::malloc(CUBE(loadDistance) * sizeof(Chunk*)))
         , loadDistance(loadDistance)
         , chunkTree(loadDistance)
+        , chunkBuilderPool((ChunkBuilder*)Memory::malloc(NUM_CHUNK_BUILDERS
+                * sizeof(ChunkBuilder)))
+        , numRebuildsWaiting(0)
+        , priorityCenter(0)
+        , priorityDirection(0.f)
+        , numEditsRun {0}
+        , numEditsStale {0}
+        , numEditsCoalesced {0}
         , renderList((Chunk**)Memory::malloc(CUBE(loadDistance) * sizeof(Chunk*)))
         , chunkOffset(3, 0, 0)
+        , lodDistances {loadDistance / 4, loadDistance * 3 / 8}
+        , lodsDirty(true)
+        , compressionDistance(loadDistance / 4)
+        , compressionDirty(true)
         , context(&context)
-        , running {true} {
+        , regionStore(saveDirectory)
+        , mesherType {MesherType::BINARY}
+        , numValidatedQuads {0}
+        , numValidatedPlainQuads {0}
+        , numMeshAllocations {0}
+        , numQueuedCompressions {0}
+        , maxUploadBytes(DEFAULT_MAX_UPLOAD_BYTES)
+        , maxUploadTime(DEFAULT_MAX_UPLOAD_TIME)
+        , numUploadedBytes(0)
+        , lastEditLatency(0.0)
+        , totalEditLatency(0.0)
+        , numVisibleEdits(0)
+        , cameraVelocity(0.f)
+        , lastCameraPosition(0.f)
+        , lastUpdateTime(-1.0)
+        , jobSystem(get_num_workers(numWorkers)) {
     IndexedModel model;
+    model.allocateElement(2, true); // ChunkVertex
     model.allocateElement(3);
-    model.allocateElement(3);
-    model.allocateElement(3);
-    model.allocateElement(3);
-    model.setInstancedElementStartIndex(3);
+    model.setInstancedElementStartIndex(1);
+
+    IndexedModel quadModel;
+    quadModel.allocateElement(1);
+    ChunkBuilder::build_quad_indices(quadModel);
+
+    quadIndices = new VertexArray(context, quadModel, GL_STATIC_DRAW);
+
+    pendingLoads.queuedGenerations.resize(CUBE(loadDistance), NOT_QUEUED);
+    pendingRebuilds.queuedGenerations.resize(CUBE(loadDistance), NOT_QUEUED);
+
+    for (auto* pending : {&pendingLoads, &pendingRebuilds}) {
+        pending->numRun = 0;
+        pending->numStale = 0;
+        pending->numCoalesced = 0;
+    }
 
     for (int32 i = 0; i < CUBE(loadDistance); ++i) {
         new (chunkPool + i) Chunk();
 
-        chunkPool[i].init(context, model);
+        chunkPool[i].init(context, model, *quadIndices);
         loadedChunks[i] = chunkPool + i;
     }
 
+    freeChunkBuilders.reserve(NUM_CHUNK_BUILDERS);
+    chunksToBuffer.reserve(NUM_CHUNK_BUILDERS);
+
+    for (int32 i = 0; i < NUM_CHUNK_BUILDERS; ++i) {
+        new (chunkBuilderPool + i) ChunkBuilder();
+        freeChunkBuilders.push_back(chunkBuilderPool + i);
+    }
+
     for (int32 z = 0; z < loadDistance; ++z) {
         for (int32 y = 0; y < loadDistance; ++y) {
             for (int32 x = 0; x < loadDistance; ++x) {
@@ -47,26 +173,92 @@ ChunkManager::ChunkManager(RenderContext& context, int32 loadDistance)
             }
         }
     }
-
-    for (int32 i = 0; i < NUM_THREADS; ++i) {
-        loadThreads.emplace_back([&]() { load_chunks(); });
-        rebuildThreads.emplace_back([&]() { rebuild_chunks(); });
-        blockUpdateThreads.emplace_back([&]() { handle_block_updates(); });
-    }
 }
 
 void ChunkManager::update(const Camera& camera) {
+    const Vector3i oldOffset = chunkOffset;
+
+    const Vector3f cameraPosition(camera.invView[3]);
+    const double time = Time::getTime();
+
+    if (lastUpdateTime >= 0.0 && time > lastUpdateTime) {
+        const Vector3f velocity = (cameraPosition - lastCameraPosition)
+                / static_cast<float>(time - lastUpdateTime);
+
+        cameraVelocity += (velocity - cameraVelocity) * VELOCITY_SMOOTHING;
+    }
+
+    lastCameraPosition = cameraPosition;
+    lastUpdateTime = time;
+
+    // before the loads the camera move queues, so they are sorted for the
+    // new position right away
+    update_priorities(camera);
     update_load_list(camera);
 
+    if (lodsDirty || chunkOffset != oldOffset) {
+        update_lods();
+    }
+
+    if (compressionDirty || chunkOffset != oldOffset) {
+        update_compression();
+    }
+
     std::unique_lock<std::mutex> lock(bufferMutex);
 
-    while (!chunksToBuffer.empty()) {
-        auto cb = chunksToBuffer.front();
-        chunksToBuffer.pop();
+    // the meshes left over once the budget is spent keep their builders
+    // until a later frame, so the ones needed first go up first
+    std::sort(std::begin(chunksToBuffer), std::end(chunksToBuffer),
+            [this](const ChunkBuilder* a, const ChunkBuilder* b) {
+        return get_priority(a->get_chunk()) < get_priority(b->get_chunk());
+    });
+
+    const double uploadStart = Time::getTime();
+    size_t numFrameBytes = 0;
+    uint32 numFrameUploads = 0;
+    uint32 numDone = 0;
+
+    for (; numDone < chunksToBuffer.size(); ++numDone) {
+        auto* cb = chunksToBuffer[numDone];
+
+        // a mesh of a chunk that has moved on since is dropped, the rebuild
+        // its move queued uploads the new one
+        if (cb->get_chunk()->getGeneration() == cb->get_generation()) {
+            if (numFrameUploads > 0 && ((maxUploadBytes > 0
+                    && numFrameBytes >= maxUploadBytes) || (maxUploadTime > 0.0
+                    && Time::getTime() - uploadStart >= maxUploadTime))) {
+                break;
+            }
+
+            cb->fill_buffers();
+
+            numFrameBytes += cb->num_uploaded_bytes();
+            ++numFrameUploads;
 
-        cb->fill_buffers();
-        cb.reset();
+            if (const double editTime = cb->get_edit_time(); editTime >= 0.0) {
+                lastEditLatency = Time::getTime() - editTime;
+                totalEditLatency += lastEditLatency;
+                ++numVisibleEdits;
+            }
+        }
+
+        cb->clear();
+
+        freeChunkBuilders.push_back(cb);
+    }
+
+    chunksToBuffer.erase(std::begin(chunksToBuffer),
+            std::begin(chunksToBuffer) + numDone);
+    numUploadedBytes += numFrameBytes;
+
+    const uint32 numRebuilds = Math::min(numRebuildsWaiting,
+            static_cast<uint32>(freeChunkBuilders.size()));
+
+    for (uint32 i = 0; i < numRebuilds; ++i) {
+        submit_rebuild();
     }
+
+    numRebuildsWaiting -= numRebuilds;
 }
 
 void ChunkManager::update_load_list(const Camera& camera) {
@@ -95,8 +287,9 @@ void ChunkManager::update_load_list(const Camera& camera) {
                     newChunks[get_local_index(pLocal)] = chnk;
 
                     if (chnk->getPosition() != pLocal + newOffset) {
+                        save_chunk(chnk);
                         chnk->moveTo(pLocal + newOffset);
-                        chunksToLoad.push(chnk);
+                        queue_load(chnk);
                     }
                 }
                 else {
@@ -118,8 +311,9 @@ void ChunkManager::update_load_list(const Camera& camera) {
                             chnk) {
                         newChunks[get_local_index(pLocal)] = chnk;
 
+                        save_chunk(chnk);
                         chnk->moveTo(pLocal + newOffset);
-                        chunksToLoad.push(chnk);
+                        queue_load(chnk);
                     }
                     else {
                         DEBUG_LOG_TEMP2("MISSING CHUNK REEEEE");
@@ -134,38 +328,103 @@ void ChunkManager::update_load_list(const Camera& camera) {
     Memory::memcpy(loadedChunks, newChunks, CUBE(loadDistance) * sizeof(Chunk*));
 
     update_chunk_tree();
+    prefetch_saved_chunks();
+}
+
+void ChunkManager::save_chunk(Chunk* chunk) {
+    ArrayList<uint8> data;
+
+    if (chunk->save(data)) {
+        regionStore.save_chunk(chunk->getPosition(), std::move(data));
+    }
 }
 
-void ChunkManager::rebuild_chunks() {
-    while (running) {
-        std::unique_lock<std::mutex> lock(rebuildMutex);
+void ChunkManager::prefetch_saved_chunks() {
+    Vector3i ahead(cameraVelocity * (PREFETCH_TIME / Chunk::CHUNK_SIZE));
 
-        Chunk* chunk = nullptr;
+    for (int32 i = 0; i < 3; ++i) {
+        ahead[i] = Math::clamp(ahead[i], -loadDistance, loadDistance);
+    }
 
-        if (!chunksToRebuild.empty()) {
-            chunk = chunksToRebuild.front();
-            chunksToRebuild.pop();
-        }
+    if (ahead.x == 0 && ahead.y == 0 && ahead.z == 0) {
+        return;
+    }
 
-        lock.unlock();
+    // the part of the predicted load cube that is not loaded yet
+    prefetchList.clear();
 
-        if (chunk) {
-            auto cb = Memory::make_shared<ChunkBuilder>();
-            chunk->rebuild(cb);
+    for (int32 x = 0; x < loadDistance; ++x) {
+        for (int32 y = 0; y < loadDistance; ++y) {
+            for (int32 z = 0; z < loadDistance; ++z) {
+                const Vector3i localPos = ahead + Vector3i(x, y, z);
 
-            std::unique_lock<std::mutex> bufferLock(bufferMutex);
-            chunksToBuffer.push(cb);
+                if (!is_valid_local_index(localPos)) {
+                    prefetchList.push_back(localPos + chunkOffset);
+                }
+            }
         }
     }
+
+    regionStore.prefetch_chunks(prefetchList);
+}
+
+void ChunkManager::rebuild_chunk(Chunk* chunk, uint32 generation) {
+    // moved since it was queued, the load queues the rebuild again once
+    // the blocks are in
+    if (chunk->needsLoad()) {
+        ++pendingRebuilds.numStale;
+        return;
+    }
+
+    ChunkBuilder* cb = acquire_chunk_builder(chunk);
+
+    if (!cb) {
+        return;
+    }
+
+    ChunkBorders borders;
+    gather_borders(chunk->getPosition(), borders);
+
+    const MesherType type = mesherType;
+    bool refined = false;
+
+    // gather_borders() waits out update_load_list(), which may have moved
+    // the chunk since the check above
+    if (!chunk->rebuild(*cb, borders, generation, refined, type)) {
+        ++pendingRebuilds.numStale;
+
+        std::unique_lock<std::mutex> bufferLock(bufferMutex);
+        freeChunkBuilders.push_back(cb);
+
+        return;
+    }
+
+    ++pendingRebuilds.numRun;
+
+    // neighbors only cull against full resolution meshes
+    if (refined) {
+        queue_neighbor_rebuilds(chunk->getPosition(), ALL_SIDES);
+    }
+
+    if (type == MesherType::VALIDATE) {
+        numValidatedQuads += cb->num_quads();
+        numValidatedPlainQuads += cb->num_plain_quads();
+    }
+
+    numMeshAllocations += cb->num_allocations();
+
+    std::unique_lock<std::mutex> bufferLock(bufferMutex);
+    chunksToBuffer.push_back(cb);
 }
 
 void ChunkManager::render_chunks(RenderTarget& target,
         Shader& shader, const Camera& camera) {
     update_render_list(camera);
 
+    // vertex arrays are only touched on this thread, fill_buffers() runs
+    // in update(), so drawing needs no chunk lock
     for (int32 i = 0; i < numToRender; ++i) {
         Chunk* c = renderList[i];
-        std::unique_lock<std::mutex> lock(c->getMutex());
 
         context->draw(target, shader, c->getVertexArray(), GL_TRIANGLES);
     }
@@ -213,89 +472,189 @@ bool ChunkManager::find_block_on_ray(const Vector3f& position,
 
 void ChunkManager::add_block(const Vector3i& position,
         const BlockType blockType) {
-    Vector3i blockPos = position % Chunk::CHUNK_SIZE;
+    Vector3i chunkPos, blockPos;
+    split_block_position(position, chunkPos, blockPos);
+    chunkPos -= chunkOffset;
 
-    if (blockPos.x < 0) {
-        blockPos.x += Chunk::CHUNK_SIZE;
-    }
+    auto* chunk = loadedChunks[get_local_index(chunkPos)];
 
-    if (blockPos.y < 0) {
-        blockPos.y += Chunk::CHUNK_SIZE;
-    }
+    std::unique_lock<std::mutex> lock(blockUpdateMutex);
+    blockUpdates[chunk].push_back({blockPos,
+            BlockRegistry::getInstance().is_solid(blockType), blockType,
+            Time::getTime(), chunk->getGeneration()});
+    lock.unlock();
 
-    if (blockPos.z < 0) {
-        blockPos.z += Chunk::CHUNK_SIZE;
-    }
+    queue_block_updates(chunk);
+}
 
-    const Vector3i chunkPos = (position - blockPos) / Chunk::CHUNK_SIZE
-            - chunkOffset;
+void ChunkManager::remove_block(const Vector3i& position) {
+    Vector3i chunkPos, blockPos;
+    split_block_position(position, chunkPos, blockPos);
+    chunkPos -= chunkOffset;
 
     auto* chunk = loadedChunks[get_local_index(chunkPos)];
 
     std::unique_lock<std::mutex> lock(blockUpdateMutex);
-    blockUpdates[chunk].push_back({blockPos, true, blockType});
+    blockUpdates[chunk].push_back({blockPos, false, BlockType::AIR,
+            Time::getTime(), chunk->getGeneration()});
+    lock.unlock();
+
+    queue_block_updates(chunk);
 }
 
-void ChunkManager::remove_block(const Vector3i& position) {
-    Vector3i blockPos = position % Chunk::CHUNK_SIZE;
+Block ChunkManager::get_block(const Vector3i& position) const {
+    Vector3i chunkPos, blockPos;
+    split_block_position(position, chunkPos, blockPos);
+    chunkPos -= chunkOffset;
 
-    if (blockPos.x < 0) {
-        blockPos.x += Chunk::CHUNK_SIZE;
-    }
+    const auto* chunk = loadedChunks[get_local_index(chunkPos)];
 
-    if (blockPos.y < 0) {
-        blockPos.y += Chunk::CHUNK_SIZE;
-    }
+    return chunk->get(blockPos);
+}
 
-    if (blockPos.z < 0) {
-        blockPos.z += Chunk::CHUNK_SIZE;
-    }
+void ChunkManager::set_lod_distances(int32 lod1Distance,
+        int32 lod2Distance) {
+    lodDistances[0] = lod1Distance;
+    lodDistances[1] = lod2Distance;
 
-    const Vector3i chunkPos = (position - blockPos) / Chunk::CHUNK_SIZE
-            - chunkOffset;
+    lodsDirty = true;
+}
 
-    auto* chunk = loadedChunks[get_local_index(chunkPos)];
+void ChunkManager::set_compression_distance(int32 distance) {
+    compressionDistance = distance;
+    compressionDirty = true;
+}
 
-    std::unique_lock<std::mutex> lock(blockUpdateMutex);
-    blockUpdates[chunk].push_back({blockPos, false, BlockType::AIR});
+void ChunkManager::set_upload_budget(size_t numBytes, double seconds) {
+    maxUploadBytes = numBytes;
+    maxUploadTime = seconds;
+}
+
+void ChunkManager::set_mesher_type(MesherType mesherType) {
+    this->mesherType = mesherType;
+}
+
+MesherType ChunkManager::get_mesher_type() const {
+    return mesherType;
 }
 
-const Block& ChunkManager::get_block(const Vector3i& position) const {
-    Vector3i blockPos = position % Chunk::CHUNK_SIZE;
+uint32 ChunkManager::get_num_triangles() const {
+    uint32 numTriangles = 0;
 
-    if (blockPos.x < 0) {
-        blockPos.x += Chunk::CHUNK_SIZE;
+    for (int32 i = 0; i < CUBE(loadDistance); ++i) {
+        if (chunkPool[i].shouldRender()) {
+            numTriangles += chunkPool[i].getVertexArray().getNumElements() / 3;
+        }
     }
 
-    if (blockPos.y < 0) {
-        blockPos.y += Chunk::CHUNK_SIZE;
+    return numTriangles;
+}
+
+void ChunkManager::get_ao_quad_counts(uint64& numQuads,
+        uint64& numPlainQuads) const {
+    numQuads = numValidatedQuads;
+    numPlainQuads = numValidatedPlainQuads;
+}
+
+uint64 ChunkManager::get_num_mesh_allocations() const {
+    return numMeshAllocations;
+}
+
+uint64 ChunkManager::get_num_uploaded_bytes() const {
+    return numUploadedBytes;
+}
+
+void ChunkManager::get_edit_latency(double& last, double& average) const {
+    last = lastEditLatency;
+    average = numVisibleEdits > 0 ? totalEditLatency / numVisibleEdits : 0.0;
+}
+
+uint64 ChunkManager::get_block_memory() const {
+    uint64 numBytes = 0;
+
+    for (int32 i = 0; i < CUBE(loadDistance); ++i) {
+        numBytes += chunkPool[i].getBlockMemory();
     }
 
-    if (blockPos.z < 0) {
-        blockPos.z += Chunk::CHUNK_SIZE;
+    return numBytes;
+}
+
+uint32 ChunkManager::get_num_renderable_chunks() const {
+    uint32 numRenderable = 0;
+
+    for (int32 i = 0; i < CUBE(loadDistance); ++i) {
+        if (loadedChunks[i]->shouldRender()) {
+            ++numRenderable;
+        }
     }
 
-    const Vector3i chunkPos = (position - blockPos) / Chunk::CHUNK_SIZE
-            - chunkOffset;
+    return numRenderable;
+}
 
-    const auto* chunk = loadedChunks[get_local_index(chunkPos)];
+uint32 ChunkManager::get_num_pending_chunks() const {
+    uint32 numPending = 0;
 
-    return chunk->get(blockPos);
+    for (int32 i = 0; i < CUBE(loadDistance); ++i) {
+        if (loadedChunks[i]->needsRebuild()) {
+            ++numPending;
+        }
+    }
+
+    return numPending;
 }
 
-ChunkManager::~ChunkManager() {
-    running = false;
+uint32 ChunkManager::get_num_visible_chunks(const Camera& camera) const {
+    uint32 numVisible = 0;
 
-    for (auto& thread : loadThreads) {
-        thread.join();
+    for (int32 i = 0; i < CUBE(loadDistance); ++i) {
+        if (loadedChunks[i]->shouldRender()
+                && is_in_frustum(camera.frustum, loadedChunks[i])) {
+            ++numVisible;
+        }
     }
 
-    for (auto& thread : rebuildThreads) {
-        thread.join();
+    return numVisible;
+}
+
+uint32 ChunkManager::get_num_pending_visible_chunks(
+        const Camera& camera) const {
+    uint32 numPending = 0;
+
+    for (int32 i = 0; i < CUBE(loadDistance); ++i) {
+        if (loadedChunks[i]->needsRebuild()
+                && is_in_frustum(camera.frustum, loadedChunks[i])) {
+            ++numPending;
+        }
     }
 
-    for (auto& thread : blockUpdateThreads) {
-        thread.join();
+    return numPending;
+}
+
+uint32 ChunkManager::get_num_pending_compressions() const {
+    return numQueuedCompressions;
+}
+
+void ChunkManager::get_job_counts(JobCounts& loads,
+        JobCounts& rebuilds, JobCounts& edits) const {
+    loads = {pendingLoads.numRun, pendingLoads.numStale,
+            pendingLoads.numCoalesced};
+    rebuilds = {pendingRebuilds.numRun, pendingRebuilds.numStale,
+            pendingRebuilds.numCoalesced};
+    edits = {numEditsRun, numEditsStale, numEditsCoalesced};
+}
+
+uint32 ChunkManager::get_num_queued_jobs() const {
+    return jobSystem.get_num_queued_jobs();
+}
+
+ChunkManager::~ChunkManager() {
+    // jobs still queued are dropped, the chunks they were for are saved
+    // below in whatever state they reached
+    jobSystem.stop();
+
+    // the region store writes out whatever is still queued when it goes
+    for (int32 i = 0; i < CUBE(loadDistance); ++i) {
+        save_chunk(chunkPool + i);
     }
 
     for (int32 i = 0; i < CUBE(loadDistance); ++i) {
@@ -303,89 +662,287 @@ ChunkManager::~ChunkManager() {
         chunkPool[i].~Chunk();
     }
 
+    for (int32 i = 0; i < NUM_CHUNK_BUILDERS; ++i) {
+        chunkBuilderPool[i].~ChunkBuilder();
+    }
+
+    Memory::free(chunkBuilderPool);
+
+    delete quadIndices;
+
     Memory::free(renderList);
 
     Memory::free(loadedChunks);
     Memory::free(chunkPool);
 }
 
-void ChunkManager::load_chunks() {
-    while (running) {
-        std::unique_lock<std::mutex> lock(loadMutex);
+void ChunkManager::load_chunk(Chunk* chunk, uint32 generation) {
+    ++pendingLoads.numRun;
+
+    // only edited chunks were ever saved, the rest is generated again
+    const Vector3i chunkPos = chunk->getPosition();
 
-        Chunk* chunk = nullptr;
+    // the region store holds its lock during the call, edits are copied
+    // out so the terrain under them is generated once it is let go of
+    ArrayList<uint8> savedEdits;
 
-        if (!chunksToLoad.empty()) {
-            chunk = chunksToLoad.front();
-            chunksToLoad.pop();
+    bool loaded = regionStore.load_chunk(chunkPos,
+            [&](const uint8* data, size_t size) {
+        if (Chunk::isEditSave(data, size)) {
+            savedEdits.assign(data, data + size);
+            return true;
         }
 
-        lock.unlock();
+        return chunk->load(chunkPos, generation, data, size,
+                terrainGenerator);
+    });
+
+    if (loaded && !savedEdits.empty()) {
+        loaded = chunk->load(chunkPos, generation, savedEdits.data(),
+                savedEdits.size(), terrainGenerator);
+    }
+
+    if (!loaded) {
+        chunk->load(chunkPos, generation, terrainGenerator);
+    }
+
+    // moved while loading, the load queued by the move takes over
+    if (chunk->getGeneration() != generation) {
+        return;
+    }
+
+    // loads leave the blocks expanded
+    if (chunk->isCompressed()) {
+        queue_compression(chunk);
+    }
 
-        if (chunk) {
-            std::unique_lock<std::mutex> rebuildLock(rebuildMutex);
+    // edits made while the chunk was loading waited for it
+    std::unique_lock<std::mutex> updateLock(blockUpdateMutex);
+    const auto it = blockUpdates.find(chunk);
+    const bool hasUpdates = it != std::end(blockUpdates)
+            && !it->second.empty();
+    updateLock.unlock();
 
-            if (chunksToRebuild.size() < MAX_CHUNKS_TO_REBUILD) {
-                rebuildLock.unlock();
+    if (hasUpdates) {
+        queue_block_updates(chunk);
+    }
 
-                chunk->load(terrainGenerator);
+    uint64 rows[Chunk::CHUNK_SIZE];
+    uint32 solidSides = 0;
 
-                rebuildLock.lock();
-                chunksToRebuild.push(chunk);
-            }
-            else {
-                lock.lock();
-                chunksToLoad.push(chunk);
-            }
+    for (int32 i = 0; i < NUM_SIDES; ++i) {
+        if (chunk->getBorder(chunkPos, static_cast<Side>(i), rows)
+                && has_solid_rows(rows)) {
+            solidSides |= 1 << i;
         }
     }
+
+    queue_neighbor_rebuilds(chunkPos, solidSides);
+    queue_rebuild(chunk);
 }
 
-void ChunkManager::handle_block_updates() {
-    while (running) {
-        std::unique_lock<std::mutex> lock(blockUpdateMutex);
-        Chunk* chunk = nullptr;
-        ArrayList<BlockUpdate> chunkUpdateList;
+void ChunkManager::apply_block_updates(Chunk* chunk) {
+    std::unique_lock<std::mutex> lock(blockUpdateMutex);
 
-        for (auto it = std::begin(blockUpdates), end = std::end(blockUpdates);
-                it != end; ++it) {
-            if (!it->second.empty()) {
-                chunk = it->first;
-                chunkUpdateList.assign(std::begin(it->second),
-                        std::end(it->second));
-                it->second.clear();
+    // an earlier job may have applied these along with its own
+    auto it = blockUpdates.find(chunk);
 
-                break;
-            }
+    if (it == std::end(blockUpdates) || it->second.empty()) {
+        ++numEditsCoalesced;
+        return;
+    }
+
+    // the load would replace the blocks the edits are made to, they stay
+    // queued until load_chunk() is done, which checks under the same lock
+    if (chunk->needsLoad()) {
+        return;
+    }
+
+    ArrayList<BlockUpdate> chunkUpdateList;
+    chunkUpdateList.swap(it->second);
+
+    lock.unlock();
+
+    ++numEditsRun;
+
+    std::unique_lock<std::mutex> chunkLock(chunk->getMutex());
+
+    uint32 borderSides = 0;
+    bool applied = false;
+
+    for (const auto& update : chunkUpdateList) {
+        // made before the chunk moved, the block is not in it anymore
+        if (update.generation != chunk->getGeneration()) {
+            ++numEditsStale;
+            continue;
         }
 
-        lock.unlock();
+        chunk->setBlock(update.position, update.active, update.type);
+        chunk->markEdited(update.time);
+        borderSides |= get_border_sides(update.position);
+        applied = true;
+    }
 
-        if (chunk) {
-            std::unique_lock<std::mutex> chunkLock(chunk->getMutex());
+    const Vector3i chunkPos = chunk->getPosition();
 
-            for (auto it = std::begin(chunkUpdateList), end = std::end(chunkUpdateList);
-                    it != end; ++it) {
-                auto& block = chunk->get(it->position);
-                block.set_active(it->active);
-                block.set_type(it->type);
+    chunkLock.unlock();
 
-                if (it->active) {
-                    chunk->getBlockTree().add(it->position);
-                }
-                else {
-                    chunk->getBlockTree().remove(it->position);
-                }
-            }
+    if (!applied) {
+        return;
+    }
+
+    // edits expand compressed blocks, which go back once they are done
+    if (chunk->isCompressed()) {
+        queue_compression(chunk);
+    }
+
+    queue_neighbor_rebuilds(chunkPos, borderSides);
+    queue_rebuild(chunk);
+}
+
+bool ChunkManager::push_pending(PendingQueue& pending, Chunk* chunk) {
+    const uint32 generation = chunk->getGeneration();
+
+    std::unique_lock<std::mutex> lock(pendingMutex);
+
+    uint32& queuedGeneration = pending.queuedGenerations[chunk - chunkPool];
+
+    if (queuedGeneration == generation) {
+        ++pending.numCoalesced;
+        return false;
+    }
+
+    queuedGeneration = generation;
+
+    pending.heap.push_back({chunk, generation, get_priority(chunk)});
+    std::push_heap(std::begin(pending.heap), std::end(pending.heap));
+
+    return true;
+}
+
+Chunk* ChunkManager::pop_pending(PendingQueue& pending, uint32& generation) {
+    std::unique_lock<std::mutex> lock(pendingMutex);
+
+    if (pending.heap.empty()) {
+        return nullptr;
+    }
+
+    std::pop_heap(std::begin(pending.heap), std::end(pending.heap));
+
+    const PendingChunk entry = pending.heap.back();
+    pending.heap.pop_back();
+
+    // requests from here on need a new entry, this one is being taken
+    uint32& queuedGeneration =
+            pending.queuedGenerations[entry.chunk - chunkPool];
+
+    if (queuedGeneration == entry.generation) {
+        queuedGeneration = NOT_QUEUED;
+    }
+
+    if (entry.chunk->getGeneration() != entry.generation) {
+        ++pending.numStale;
+        return nullptr;
+    }
+
+    generation = entry.generation;
+
+    return entry.chunk;
+}
+
+uint32 ChunkManager::get_priority(const Chunk* chunk) const {
+    const Vector3i delta = chunk->getPosition() - priorityCenter;
+
+    const uint32 priority = delta.x * delta.x + delta.y * delta.y
+            + delta.z * delta.z;
+
+    if (is_in_frustum(priorityFrustum, chunk)) {
+        return priority;
+    }
+
+    return priority * HIDDEN_DISTANCE_SCALE * HIDDEN_DISTANCE_SCALE;
+}
+
+void ChunkManager::update_priorities(const Camera& camera) {
+    // the chunk update_load_list() centers the load cube on
+    const Vector3i center = Vector3i(camera.invView[3]) / Chunk::CHUNK_SIZE;
+    const Vector3f direction = -Vector3f(camera.invView[2]);
+
+    std::unique_lock<std::mutex> lock(pendingMutex);
+
+    if (center == priorityCenter
+            && Math::dot(direction, priorityDirection) > MAX_TURN_COS) {
+        return;
+    }
+
+    priorityCenter = center;
+    priorityDirection = direction;
+    priorityFrustum = camera.frustum;
 
-            chunkLock.unlock();
+    for (auto* pending : {&pendingLoads, &pendingRebuilds}) {
+        auto& heap = pending->heap;
 
-            std::unique_lock<std::mutex> rebuildLock(rebuildMutex);
-            chunksToRebuild.push(chunk);
+        // stale entries go now rather than being sorted again, their jobs
+        // find nothing left to take
+        const auto end = std::remove_if(std::begin(heap), std::end(heap),
+                [](const PendingChunk& entry) {
+            return entry.chunk->getGeneration() != entry.generation;
+        });
+
+        pending->numStale += std::end(heap) - end;
+        heap.erase(end, std::end(heap));
+
+        for (auto& entry : heap) {
+            entry.priority = get_priority(entry.chunk);
+        }
+
+        std::make_heap(std::begin(heap), std::end(heap));
+    }
+}
+
+void ChunkManager::queue_load(Chunk* chunk) {
+    if (!push_pending(pendingLoads, chunk)) {
+        return;
+    }
+
+    jobSystem.submit([this]() {
+        uint32 generation;
+
+        if (Chunk* next = pop_pending(pendingLoads, generation); next) {
+            load_chunk(next, generation);
         }
+    }, JobPriority::LOW);
+}
+
+void ChunkManager::queue_rebuild(Chunk* chunk) {
+    if (push_pending(pendingRebuilds, chunk)) {
+        submit_rebuild();
     }
 }
 
+void ChunkManager::submit_rebuild() {
+    jobSystem.submit([this]() {
+        uint32 generation;
+
+        if (Chunk* next = pop_pending(pendingRebuilds, generation); next) {
+            rebuild_chunk(next, generation);
+        }
+    });
+}
+
+void ChunkManager::queue_block_updates(Chunk* chunk) {
+    jobSystem.submit([this, chunk]() { apply_block_updates(chunk); });
+}
+
+void ChunkManager::queue_compression(Chunk* chunk) {
+    ++numQueuedCompressions;
+
+    jobSystem.submit([this, chunk]() {
+        chunk->updateCompression();
+        --numQueuedCompressions;
+    }, JobPriority::LOW);
+}
+
 void ChunkManager::update_render_list(const Camera& camera) {
     numToRender = 0;
 
@@ -408,14 +965,10 @@ void ChunkManager::update_render_list(const Camera& camera) {
                     }
                 }
 
-                const Vector3f worldPos = static_cast<Vector3f>(c->getPosition())
-                        * static_cast<float>(Chunk::CHUNK_SIZE);
-                
-                if (!camera.frustum.intersectsCube(worldPos, Chunk::CHUNK_SIZE)) {
+                if (!is_in_frustum(camera.frustum, c)) {
                     continue;
                 }
 
-
                 renderList[numToRender++] = c;
             }
         }
@@ -437,6 +990,134 @@ void ChunkManager::update_chunk_tree() {
     }
 }
 
+void ChunkManager::update_lods() {
+    for (int32 i = 0; i < CUBE(loadDistance); ++i) {
+        Chunk* chunk = loadedChunks[i];
+
+        const int32 distance = get_camera_distance(chunk);
+
+        const int32 lod = distance > lodDistances[1] ? 2
+                : distance > lodDistances[0] ? 1 : 0;
+
+        if (!chunk->setLod(lod)) {
+            continue;
+        }
+
+        // neighbors stop culling against a chunk before its coarse mesh
+        // replaces the full resolution one, and only start again once it is
+        // back at full resolution, see rebuild_chunk()
+        if (lod > 0) {
+            queue_neighbor_rebuilds(chunk->getPosition(), ALL_SIDES);
+        }
+
+        queue_rebuild(chunk);
+    }
+
+    lodsDirty = false;
+}
+
+void ChunkManager::update_compression() {
+    for (int32 i = 0; i < CUBE(loadDistance); ++i) {
+        Chunk* chunk = loadedChunks[i];
+
+        // chunks still loading are queued once they are done
+        if (chunk->setCompressed(get_camera_distance(chunk)
+                > compressionDistance)) {
+            queue_compression(chunk);
+        }
+    }
+
+    compressionDirty = false;
+}
+
+int32 ChunkManager::get_camera_distance(const Chunk* chunk) const {
+    const Vector3i delta = chunk->getPosition() - chunkOffset
+            - Vector3i(loadDistance / 2);
+
+    return Math::max(Math::abs(delta.x),
+            Math::max(Math::abs(delta.y), Math::abs(delta.z)));
+}
+
+bool ChunkManager::is_in_frustum(const Frustum& frustum,
+        const Chunk* chunk) const {
+    const Vector3f worldPos = static_cast<Vector3f>(chunk->getPosition())
+            * static_cast<float>(Chunk::CHUNK_SIZE);
+
+    return frustum.intersectsCube(worldPos, Chunk::CHUNK_SIZE);
+}
+
+void ChunkManager::get_neighbors(const Vector3i& chunkPos,
+        Chunk** neighbors) {
+    std::unique_lock<std::mutex> lock(loadMutex);
+
+    for (int32 i = 0; i < NUM_SIDES; ++i) {
+        const Vector3i localPos = chunkPos + SIDE_OFFSETS[i] - chunkOffset;
+
+        neighbors[i] = is_valid_local_index(localPos)
+                ? loadedChunks[get_local_index(localPos)] : nullptr;
+    }
+}
+
+void ChunkManager::gather_borders(const Vector3i& chunkPos,
+        ChunkBorders& borders) {
+    Chunk* neighbors[NUM_SIDES];
+    get_neighbors(chunkPos, neighbors);
+
+    for (int32 i = 0; i < NUM_SIDES; ++i) {
+        // neighbors that are missing or not loaded yet are treated as air,
+        // they queue this chunk again once they finish loading
+        if (!neighbors[i] || !neighbors[i]->getBorder(chunkPos + SIDE_OFFSETS[i],
+                static_cast<Side>(i ^ 1), borders.rows[i])) {
+            Memory::memset(borders.rows[i], 0, sizeof(borders.rows[i]));
+        }
+    }
+}
+
+void ChunkManager::queue_neighbor_rebuilds(const Vector3i& chunkPos,
+        uint32 sides) {
+    if (!sides) {
+        return;
+    }
+
+    Chunk* neighbors[NUM_SIDES];
+    get_neighbors(chunkPos, neighbors);
+
+    uint64 rows[Chunk::CHUNK_SIZE];
+
+    for (int32 i = 0; i < NUM_SIDES; ++i) {
+        // a neighbor with an empty facing layer has no faces to gain or lose
+        if (!(sides & (1 << i)) || !neighbors[i]
+                || !neighbors[i]->getBorder(chunkPos + SIDE_OFFSETS[i],
+                static_cast<Side>(i ^ 1), rows) || !has_solid_rows(rows)) {
+            neighbors[i] = nullptr;
+        }
+    }
+
+    for (auto* neighbor : neighbors) {
+        if (neighbor) {
+            queue_rebuild(neighbor);
+        }
+    }
+}
+
+ChunkBuilder* ChunkManager::acquire_chunk_builder(Chunk* chunk) {
+    std::unique_lock<std::mutex> lock(bufferMutex);
+
+    if (freeChunkBuilders.empty()) {
+        // or coalesced into a rebuild queued since, which has its job
+        if (push_pending(pendingRebuilds, chunk)) {
+            ++numRebuildsWaiting;
+        }
+
+        return nullptr;
+    }
+
+    ChunkBuilder* cb = freeChunkBuilders.back();
+    freeChunkBuilders.pop_back();
+
+    return cb;
+}
+
 int32 ChunkManager::get_local_index(const Vector3i& localPos) const {
     return (localPos.x * loadDistance + localPos.y) * loadDistance
             + localPos.z;
@@ -4,12 +4,11 @@
 #include <engine/core/memory.hpp>
 
 #include <engine/core/array-list.hpp>
-#include <engine/core/queue.hpp>
 #include <engine/core/tree-map.hpp>
+#include <engine/core/string.hpp>
 
 #include <engine/math/vector.hpp>
 
-#include <thread>
 #include <mutex>
 #include <atomic>
 
@@ -17,6 +16,9 @@
 
 #include "block.hpp"
 #include "chunk-tree.hpp"
+#include "frustum.hpp"
+#include "job-system.hpp"
+#include "region-store.hpp"
 
 class Chunk;
 class RenderContext;
@@ -25,10 +27,17 @@ class Shader;
 class Camera;
 class VertexArray;
 class ChunkBuilder;
+struct ChunkBorders;
+enum class MesherType;
 
 class ChunkManager {
     public:
-        ChunkManager(RenderContext& context, int32 loadDistance);
+        // edited chunks are saved to region files in saveDirectory when
+        // they stream out and read back from there instead of generated.
+        // Loads, rebuilds and edits run on numWorkers threads, 0 takes one
+        // per core but the one the main thread runs on.
+        ChunkManager(RenderContext& context, int32 loadDistance,
+                const String& saveDirectory, uint32 numWorkers = 0);
 
         void update(const Camera& camera);
         void render_chunks(RenderTarget& target, Shader& shader,
@@ -42,7 +51,68 @@ class ChunkManager {
                 const BlockType blockType);
         void remove_block(const Vector3i& position);
 
-        const Block& get_block(const Vector3i& position) const;
+        Block get_block(const Vector3i& position) const;
+
+        void set_mesher_type(MesherType mesherType);
+        MesherType get_mesher_type() const;
+
+        // chunks further than lod1Distance chunks from the camera are meshed
+        // at half resolution, further than lod2Distance at quarter
+        void set_lod_distances(int32 lod1Distance, int32 lod2Distance);
+
+        // chunks further than distance chunks from the camera keep their
+        // blocks compressed, which the workers take care of
+        void set_compression_distance(int32 distance);
+
+        // update() stops uploading meshes once numBytes or seconds are
+        // spent, 0 for no limit. At least one mesh goes up every frame, the
+        // rest wait for the next ones, nearest visible chunk first.
+        void set_upload_budget(size_t numBytes, double seconds);
+
+        uint32 get_num_triangles() const;
+        void get_ao_quad_counts(uint64& numQuads, uint64& numPlainQuads) const;
+
+        uint64 get_num_mesh_allocations() const;
+        uint64 get_num_uploaded_bytes() const;
+
+        // seconds from a block edit to the upload that made it visible
+        void get_edit_latency(double& last, double& average) const;
+
+        // bytes held by the block storage of every pooled chunk
+        uint64 get_block_memory() const;
+
+        // chunks in range with a mesh to draw, one draw call each before
+        // frustum and occlusion culling
+        uint32 get_num_renderable_chunks() const;
+
+        // chunks in range that have not been meshed and uploaded since they
+        // were last loaded
+        uint32 get_num_pending_chunks() const;
+
+        // chunks the camera sees that are drawn, and the ones it sees that
+        // still wait to be loaded or meshed
+        uint32 get_num_visible_chunks(const Camera& camera) const;
+        uint32 get_num_pending_visible_chunks(const Camera& camera) const;
+
+        // chunks waiting for a worker to compress or expand their blocks
+        uint32 get_num_pending_compressions() const;
+
+        struct JobCounts {
+            uint64 numRun;
+            // dropped before they started, the chunk had moved on
+            uint64 numStale;
+            // merged into a job already queued for the chunk
+            uint64 numCoalesced;
+        };
+
+        // since the manager was created. Stale edits count the edits
+        // dropped rather than jobs, coalesced ones the jobs that found
+        // theirs applied by an earlier one
+        void get_job_counts(JobCounts& loads, JobCounts& rebuilds,
+                JobCounts& edits) const;
+
+        // loads, rebuilds, edits and compressions no worker has started
+        uint32 get_num_queued_jobs() const;
 
         ~ChunkManager();
     private:
@@ -52,49 +122,175 @@ class ChunkManager {
             Vector3i position;
             bool active;
             BlockType type;
+            double time;
+            // of the chunk when the edit was made, see Chunk::moveTo()
+            uint32 generation;
         };
 
         Chunk* chunkPool;
+        VertexArray* quadIndices;
         Chunk** loadedChunks;
         int32 loadDistance;
 
         ChunkTreeNode chunkTree;
 
-        Queue<Chunk*> chunksToLoad;
+        // guards loadedChunks against update_load_list() for the workers
         std::mutex loadMutex;
 
-        Queue<Chunk*> chunksToRebuild;
-        std::mutex rebuildMutex;
+        // builders are reused across rebuilds so their vertex buffers keep
+        // their capacity, the free list, chunksToBuffer and the count of
+        // rebuilds waiting for a builder share bufferMutex
+        ChunkBuilder* chunkBuilderPool;
+        ArrayList<ChunkBuilder*> freeChunkBuilders;
 
-        Queue<Memory::SharedPointer<ChunkBuilder>> chunksToBuffer;
+        ArrayList<ChunkBuilder*> chunksToBuffer;
+        uint32 numRebuildsWaiting;
         std::mutex bufferMutex;
 
+        // heap entries, the one with the lowest priority is on top
+        struct PendingChunk {
+            Chunk* chunk;
+            uint32 generation;
+            uint32 priority;
+
+            inline bool operator<(const PendingChunk& other) const {
+                return priority > other.priority;
+            }
+        };
+
+        // chunks waiting to be loaded or rebuilt, nearest visible chunk
+        // first. A job is submitted for every entry and takes whichever is
+        // on top when it runs, so the order follows the camera without the
+        // job queues being touched.
+        //
+        // An entry is only pushed when the chunk has none for its current
+        // generation, later requests are coalesced into it. Entries for a
+        // generation the chunk has moved on from are dropped when taken.
+        struct PendingQueue {
+            ArrayList<PendingChunk> heap;
+            // by pool index, the generation of the entry each chunk has
+            // in the heap, NOT_QUEUED for none
+            ArrayList<uint32> queuedGenerations;
+
+            std::atomic<uint64> numRun;
+            std::atomic<uint64> numStale;
+            std::atomic<uint64> numCoalesced;
+        };
+
+        PendingQueue pendingLoads;
+        PendingQueue pendingRebuilds;
+        // the camera the priorities were worked out for, kept for the
+        // entries the workers push
+        Vector3i priorityCenter;
+        Vector3f priorityDirection;
+        Frustum priorityFrustum;
+        std::mutex pendingMutex;
+
+        // edits wait here while their chunk is loading, load_chunk()
+        // queues them once it is done
         TreeMap<Chunk*, ArrayList<BlockUpdate>> blockUpdates;
         std::mutex blockUpdateMutex;
+        std::atomic<uint64> numEditsRun;
+        std::atomic<uint64> numEditsStale;
+        std::atomic<uint64> numEditsCoalesced;
 
         Chunk** renderList;
         int32 numToRender;
 
         Vector3i chunkOffset;
 
-        RenderContext* context;
+        int32 lodDistances[2];
+        bool lodsDirty;
 
-        TerrainGenerator terrainGenerator;
+        int32 compressionDistance;
+        bool compressionDirty;
 
-        std::atomic<bool> running;
-
-        ArrayList<std::thread> loadThreads;
-        ArrayList<std::thread> rebuildThreads;
-        ArrayList<std::thread> blockUpdateThreads;
+        RenderContext* context;
 
-        void load_chunks();
-        void rebuild_chunks();
-        void handle_block_updates();
+        TerrainGenerator terrainGenerator;
+        RegionStore regionStore;
+
+        std::atomic<MesherType> mesherType;
+
+        // quads meshed with and without AO-aware merging, only counted
+        // while validating
+        std::atomic<uint64> numValidatedQuads;
+        std::atomic<uint64> numValidatedPlainQuads;
+
+        // heap allocations made by builders while meshing, flattens out
+        // once every pooled builder has grown to fit the chunks it sees
+        std::atomic<uint64> numMeshAllocations;
+
+        std::atomic<uint32> numQueuedCompressions;
+
+        // only touched by update() on the main thread
+        size_t maxUploadBytes;
+        double maxUploadTime;
+        uint64 numUploadedBytes;
+        double lastEditLatency;
+        double totalEditLatency;
+        uint32 numVisibleEdits;
+
+        // camera motion in blocks per second, smoothed over frames
+        Vector3f cameraVelocity;
+        Vector3f lastCameraPosition;
+        double lastUpdateTime;
+
+        ArrayList<Vector3i> prefetchList;
+
+        // nothing is submitted before the constructor is done, and the
+        // destructor stops it before tearing anything down
+        JobSystem jobSystem;
+
+        // jobs, run by the workers
+        // generation is the one the chunk was queued for
+        void load_chunk(Chunk* chunk, uint32 generation);
+        void rebuild_chunk(Chunk* chunk, uint32 generation);
+        void apply_block_updates(Chunk* chunk);
+
+        // returns false when chunk already has an entry for its generation
+        bool push_pending(PendingQueue& pending, Chunk* chunk);
+        // returns null when the entry on top was stale, or when a stop
+        // dropped the jobs of the other entries
+        Chunk* pop_pending(PendingQueue& pending, uint32& generation);
+
+        // squared distance in chunks from the camera, lower goes first
+        uint32 get_priority(const Chunk* chunk) const;
+        // works the priorities out again once the camera has crossed into
+        // another chunk or turned far enough
+        void update_priorities(const Camera& camera);
+
+        void queue_load(Chunk* chunk);
+        void queue_rebuild(Chunk* chunk);
+        // a job for the most urgent of pendingRebuilds
+        void submit_rebuild();
+        void queue_block_updates(Chunk* chunk);
+        void queue_compression(Chunk* chunk);
 
         void update_load_list(const Camera& camera);
+        // queues the blocks of an edited chunk for writing before it moves
+        void save_chunk(Chunk* chunk);
+        // reads ahead the saved chunks the load cube is headed for
+        void prefetch_saved_chunks();
         void update_render_list(const Camera& camera);
 
         void update_chunk_tree();
+        void update_lods();
+        void update_compression();
+
+        // in chunks along the axis furthest from the center of the load cube
+        int32 get_camera_distance(const Chunk* chunk) const;
+
+        bool is_in_frustum(const Frustum& frustum, const Chunk* chunk) const;
+
+        void get_neighbors(const Vector3i& chunkPos, Chunk** neighbors);
+        void gather_borders(const Vector3i& chunkPos, ChunkBorders& borders);
+        void queue_neighbor_rebuilds(const Vector3i& chunkPos, uint32 sides);
+
+        // returns null when every builder is waiting on the main thread and
+        // puts chunk back in pendingRebuilds without a job, update()
+        // submits one for every builder it hands back
+        ChunkBuilder* acquire_chunk_builder(Chunk* chunk);
 
         int32 get_local_index(const Vector3i& localPos) const;
 
@@ -3,77 +3,592 @@
 #include <engine/rendering/vertex-array.hpp>
 
 #include <engine/math/matrix.hpp>
+#include <engine/math/math.hpp>
 
 #include <cstdint>
 
+#include "block-registry.hpp"
 #include "chunk-manager.hpp"
 #include "terrain-generator.hpp"
 
+namespace {
+    typedef uint64 BitColumn;
+
+    static_assert(Chunk::CHUNK_SIZE <= 64,
+            "Chunk columns must fit in a single BitColumn");
+
+    constexpr const BitColumn FULL_COLUMN = Chunk::CHUNK_SIZE == 64
+            ? ~BitColumn(0) : ((BitColumn(1) << Chunk::CHUNK_SIZE) - 1);
+
+    constexpr const uint64 ALL_LAYERS[] = {FULL_COLUMN, FULL_COLUMN,
+            FULL_COLUMN};
+
+    // LOD meshes close every border instead of culling against neighbors
+    const ChunkBorders NO_BORDERS = {};
+
+    // load() writes palette indices into this table and packs them once
+    enum TerrainBlock : uint8 {
+        TERRAIN_AIR = 0,
+        TERRAIN_STONE,
+        TERRAIN_DIRT,
+        TERRAIN_GRASS
+    };
+
+    const Block TERRAIN_PALETTE[] = {Block(), Block(true, BlockType::STONE),
+            Block(true, BlockType::DIRT), Block(true, BlockType::GRASS)};
+
+    // first byte of the data written by save()
+    enum SaveFormat : uint8 {
+        SAVE_EDITS = 0, // the edits to apply over the generated terrain
+        SAVE_BLOCKS     // the whole block storage
+    };
+
+    // storage index with the active flag in the top bit, then the type
+    constexpr const size_t EDIT_SIZE = 6;
+    constexpr const uint32 EDIT_ACTIVE = 0x80000000;
+
+    // read by every chunk without storage of its own, never written
+    const BlockStorage AIR_BLOCKS(Chunk::NUM_BLOCKS);
+    const Block AIR_BLOCK;
+
+    // inactive blocks are neither, whatever their type, both sides are
+    // evaluated so the meshers do not branch on every block
+    bool is_meshed(const BlockRegistry& registry, const Block& block) {
+        return block.is_active() & registry.is_meshed(block.get_type());
+    }
+
+    bool is_opaque(const BlockRegistry& registry, const Block& block) {
+        return block.is_active() & registry.is_opaque(block.get_type());
+    }
+
+    constexpr Side get_side(int32 d, bool backFace) {
+        switch (d) {
+            case 0:
+                return backFace ? Side::SIDE_LEFT : Side::SIDE_RIGHT;
+            case 1:
+                return backFace ? Side::SIDE_BOTTOM : Side::SIDE_TOP;
+            default:
+                return backFace ? Side::SIDE_BACK : Side::SIDE_FRONT;
+        }
+    }
+
+    // classic voxel AO: 0 is fully occluded, 3 is unoccluded
+    constexpr uint32 get_vertex_ao(uint32 side0, uint32 side1, uint32 corner) {
+        return (side0 && side1) ? 0 : 3 - (side0 + side1 + corner);
+    }
+
+    // samples the layer outside a face d. Cells past the chunk along one
+    // axis lie in the border of that neighbor, edge and corner neighbors
+    // are not part of the snapshot and count as air.
+    uint8 get_face_ao(const BitColumn (&opaque)[Chunk::CHUNK_SIZE][Chunk::CHUNK_SIZE],
+            const ChunkBorders& borders, int32 d, int32 size, int32 u,
+            int32 v, int32 layer) {
+        const auto isSolid = [&](int32 du, int32 dv) -> uint32 {
+            const int32 a = u + du;
+            const int32 b = v + dv;
+
+            const uint32 outsideU = a < 0 || a >= size;
+            const uint32 outsideV = b < 0 || b >= size;
+            const uint32 outsideLayer = layer < 0 || layer >= size;
+
+            if (outsideU + outsideV + outsideLayer > 1) {
+                return 0;
+            }
+
+            // border rows of a side on axis n run along axis n + 1 and are
+            // indexed by axis n + 2, see Chunk::getLayer()
+            if (outsideLayer) {
+                return (borders.rows[static_cast<int32>(get_side(d,
+                        layer < 0))][b] >> a) & 1;
+            }
+
+            if (outsideU) {
+                return (borders.rows[static_cast<int32>(get_side((d + 1) % 3,
+                        a < 0))][layer] >> b) & 1;
+            }
+
+            if (outsideV) {
+                return (borders.rows[static_cast<int32>(get_side((d + 2) % 3,
+                        b < 0))][a] >> layer) & 1;
+            }
+
+            return (opaque[b][a] >> layer) & 1;
+        };
+
+        const uint32 s00 = isSolid(-1, -1);
+        const uint32 s10 = isSolid(0, -1);
+        const uint32 s20 = isSolid(1, -1);
+        const uint32 s01 = isSolid(-1, 0);
+        const uint32 s21 = isSolid(1, 0);
+        const uint32 s02 = isSolid(-1, 1);
+        const uint32 s12 = isSolid(0, 1);
+        const uint32 s22 = isSolid(1, 1);
+
+        return get_vertex_ao(s01, s10, s00)
+                | (get_vertex_ao(s21, s10, s20) << 2)
+                | (get_vertex_ao(s21, s12, s22) << 4)
+                | (get_vertex_ao(s01, s12, s02) << 6);
+    }
+
+    constexpr int32 get_axis(Side side) {
+        switch (side) {
+            case Side::SIDE_LEFT:
+            case Side::SIDE_RIGHT:
+                return 0;
+            case Side::SIDE_BOTTOM:
+            case Side::SIDE_TOP:
+                return 1;
+            default:
+                return 2;
+        }
+    }
+};
+
 Chunk::Chunk()
-        : blocks {}
+        : blocks(nullptr)
         , vertexArray(nullptr)
         , position(INT32_MAX, INT32_MAX, INT32_MAX)
-        , flags(0)
-        , blockTree(Chunk::CHUNK_SIZE) {}
+        , generation(0)
+        , flags(FLAG_NEEDS_LOAD)
+        , lod(0)
+        , compressed(false)
+        , blockTree(Chunk::CHUNK_SIZE)
+        , meshSlices {}
+        , meshType(MesherType::NUM_TYPES)
+        , meshLod(0)
+        , meshBorders {}
+        , dirtyLayers {ALL_LAYERS[0], ALL_LAYERS[1], ALL_LAYERS[2]}
+        , uploadBegin(UINT32_MAX)
+        , uploadEnd(0)
+        , editTime(-1.0)
+        , meshedEditTime(-1.0) {}
+
+void Chunk::init(RenderContext& context, const IndexedModel& model,
+        VertexArray& quadIndices) {
+    vertexArray = new VertexArray(context, model, GL_STREAM_DRAW, quadIndices);
+}
 
-void Chunk::init(RenderContext& context, const IndexedModel& model) {
-    vertexArray = new VertexArray(context, model, GL_STREAM_DRAW);
+void Chunk::load(const Vector3i& position, uint32 generation,
+        TerrainGenerator& generator) {
+    std::unique_lock<std::mutex> lock(mutex);
+
+    // a stale load running next to the current one must not generate over
+    // the edits it applied
+    if (position != this->position || generation != this->generation) {
+        return;
+    }
+
+    generate(generator);
 }
 
-void Chunk::load(TerrainGenerator& generator) {
+bool Chunk::load(const Vector3i& position, uint32 generation,
+        const uint8* data, size_t size, TerrainGenerator& generator) {
     std::unique_lock<std::mutex> lock(mutex);
 
+    // moved on since the data was read, the load queued by moveTo() will
+    // bring in the right blocks
+    if (position != this->position || generation != this->generation) {
+        return true;
+    }
+
+    if (size == 0) {
+        return false;
+    }
+
+    switch (data[0]) {
+        case SAVE_EDITS:
+            return loadEdits(data + 1, size - 1, generator);
+        case SAVE_BLOCKS:
+            return loadBlocks(data + 1, size - 1);
+        default:
+            return false;
+    }
+}
+
+bool Chunk::isEditSave(const uint8* data, size_t size) noexcept {
+    return size > 0 && data[0] == SAVE_EDITS;
+}
+
+bool Chunk::save(ArrayList<uint8>& data) {
+    std::unique_lock<std::mutex> lock(mutex);
+
+    if (!(flags & FLAG_MODIFIED) || (flags & FLAG_NEEDS_LOAD)) {
+        return false;
+    }
+
+    flags &= ~FLAG_MODIFIED;
+
+    if (flags & FLAG_COLLAPSED) {
+        data.push_back(SAVE_BLOCKS);
+        getBlocks().write(data);
+
+        return true;
+    }
+
+    data.push_back(SAVE_EDITS);
+
+    size_t offset = data.size();
+    data.resize(offset + edits.size() * EDIT_SIZE);
+
+    for (const auto& [index, block] : edits) {
+        const uint32 key = index | (block.is_active() ? EDIT_ACTIVE : 0);
+        const uint16 type = static_cast<uint16>(block.get_type());
+
+        Memory::memcpy(data.data() + offset, &key, sizeof(key));
+        Memory::memcpy(data.data() + offset + sizeof(key), &type, sizeof(type));
+        offset += EDIT_SIZE;
+    }
+
+    return true;
+}
+
+void Chunk::generate(TerrainGenerator& generator) {
     flags = FLAG_NEEDS_REBUILD;
 
+    Memory::memcpy(dirtyLayers, ALL_LAYERS, sizeof(dirtyLayers));
+    editTime = -1.0;
+
+    HashMap<uint32, Block>().swap(edits);
     blockTree.clear();
 
     const Vector3i chunkWorldPos = position * CHUNK_SIZE;
 
+    int32 heights[CHUNK_SIZE][CHUNK_SIZE];
+    int32 minHeight = INT32_MAX;
+    int32 maxHeight = INT32_MIN;
+
     for (int32 x = 0; x < CHUNK_SIZE; ++x) {
         for (int32 z = 0; z < CHUNK_SIZE; ++z) {
-            const int32 yMax = generator.getHeight(
+            heights[x][z] = generator.getHeight(
                     (chunkWorldPos.x + x), (chunkWorldPos.z + z));
 
-            for (int32 y = 0; y < CHUNK_SIZE; ++y) {
-                const int32 yGlobal = chunkWorldPos.y + y;
-                const Vector3i localPos(x, y, z);
+            minHeight = Math::min(minHeight, heights[x][z]);
+            maxHeight = Math::max(maxHeight, heights[x][z]);
+        }
+    }
 
-                if (yGlobal < yMax) {
-                    blocks[x][y][z].set_active(true);
+    // chunks entirely above or below the surface skip the per-block tree
+    // inserts and most of the meshing
+    if (chunkWorldPos.y > maxHeight) {
+        releaseBlocks();
+        flags |= FLAG_ALL_AIR;
 
-                    if (yGlobal < yMax - 3) {
-                        blocks[x][y][z].set_type(BlockType::STONE);
-                    }
-                    else {
-                        blocks[x][y][z].set_type(BlockType::DIRT);
-                    }
+        return;
+    }
 
-                    blockTree.add(localPos);
-                }
-                else if (yGlobal == yMax) {
-                    blocks[x][y][z].set_active(true);
-                    blocks[x][y][z].set_type(BlockType::GRASS);
+    const auto& registry = BlockRegistry::getInstance();
 
-                    blockTree.add(localPos);
-                }
-                else {
-                    blocks[x][y][z].set_active(false);
-                }
+    // rays only hit meshed blocks, see getBlockTree()
+    bool meshed[countof(TERRAIN_PALETTE)];
+
+    for (uint32 i = 0; i < countof(TERRAIN_PALETTE); ++i) {
+        meshed[i] = is_meshed(registry, TERRAIN_PALETTE[i]);
+    }
+
+    // everything below the surface is stone or dirt
+    const bool allSolid = chunkWorldPos.y + CHUNK_SIZE <= minHeight
+            && is_opaque(registry, TERRAIN_PALETTE[TERRAIN_STONE])
+            && is_opaque(registry, TERRAIN_PALETTE[TERRAIN_DIRT]);
+
+    if (allSolid) {
+        blockTree.fill();
+        flags |= FLAG_ALL_SOLID;
+    }
+
+    // per worker, NUM_BLOCKS would strain their stacks at CHUNK_SIZE 64
+    thread_local ArrayList<uint8> indices(NUM_BLOCKS);
+
+    forEachBlock([&](const Vector3i& localPos, uint32 i) {
+        const int32 yMax = heights[localPos.x][localPos.z];
+        const int32 yGlobal = chunkWorldPos.y + localPos.y;
+        uint8& index = indices[i];
+
+        if (yGlobal < yMax) {
+            if (yGlobal < yMax - 3) {
+                index = TERRAIN_STONE;
             }
+            else {
+                index = TERRAIN_DIRT;
+            }
+        }
+        else if (yGlobal == yMax) {
+            index = TERRAIN_GRASS;
+        }
+        else {
+            index = TERRAIN_AIR;
         }
+
+        if (!allSolid && meshed[index]) {
+            blockTree.add(localPos);
+        }
+    });
+
+    getWritableBlocks(false).assign(TERRAIN_PALETTE, countof(TERRAIN_PALETTE),
+            indices.data());
+}
+
+bool Chunk::loadEdits(const uint8* data, size_t size,
+        TerrainGenerator& generator) {
+    if (size % EDIT_SIZE != 0) {
+        return false;
     }
+
+    for (size_t offset = 0; offset < size; offset += EDIT_SIZE) {
+        uint32 key;
+        uint16 type;
+
+        Memory::memcpy(&key, data + offset, sizeof(key));
+        Memory::memcpy(&type, data + offset + sizeof(key), sizeof(type));
+
+        if ((key & ~EDIT_ACTIVE) >= static_cast<uint32>(NUM_BLOCKS)
+                || type >= BlockRegistry::getInstance().get_num_types()) {
+            return false;
+        }
+    }
+
+    generate(generator);
+
+    for (size_t offset = 0; offset < size; offset += EDIT_SIZE) {
+        uint32 key;
+        uint16 type;
+
+        Memory::memcpy(&key, data + offset, sizeof(key));
+        Memory::memcpy(&type, data + offset + sizeof(key), sizeof(type));
+
+        setBlock(getBlockPosition(key & ~EDIT_ACTIVE), key & EDIT_ACTIVE,
+                static_cast<BlockType>(type));
+    }
+
+    // the edits are already on disk
+    flags &= ~FLAG_MODIFIED;
+
+    return true;
+}
+
+bool Chunk::loadBlocks(const uint8* data, size_t size) {
+    if (!getWritableBlocks(false).read(data, size)) {
+        return false;
+    }
+
+    flags = FLAG_NEEDS_REBUILD | FLAG_COLLAPSED;
+
+    Memory::memcpy(dirtyLayers, ALL_LAYERS, sizeof(dirtyLayers));
+    editTime = -1.0;
+
+    HashMap<uint32, Block>().swap(edits);
+    blockTree.clear();
+
+    const auto& registry = BlockRegistry::getInstance();
+
+    int32 numSolid = 0;
+    int32 numOpaque = 0;
+
+    for (uint32 i = 0; i < NUM_BLOCKS; ++i) {
+        const Block block = blocks->get(i);
+
+        numSolid += block.is_active();
+        numOpaque += is_opaque(registry, block);
+    }
+
+    if (numSolid == 0) {
+        releaseBlocks();
+        flags |= FLAG_ALL_AIR;
+
+        return true;
+    }
+
+    // every add allocates down to a leaf, so mostly solid chunks carve
+    // their air out of a full tree instead
+    const bool mostlySolid = 2 * numSolid > NUM_BLOCKS;
+
+    if (mostlySolid) {
+        blockTree.fill();
+
+        if (numOpaque == NUM_BLOCKS) {
+            flags |= FLAG_ALL_SOLID;
+
+            return true;
+        }
+    }
+
+    forEachBlock([&](const Vector3i& localPos, uint32 i) {
+        const bool meshed = is_meshed(registry, blocks->get(i));
+
+        if (mostlySolid && !meshed) {
+            blockTree.remove(localPos);
+        }
+        else if (!mostlySolid && meshed) {
+            blockTree.add(localPos);
+        }
+    });
+
+    return true;
 }
 
-void Chunk::rebuild(Memory::SharedPointer<ChunkBuilder> cb) {
+
+bool Chunk::rebuild(ChunkBuilder& cb,
+        const ChunkBorders& neighborBorders, uint32 generation, bool& refined,
+        MesherType mesherType) {
+    std::unique_lock<std::mutex> meshLock(meshMutex);
     std::unique_lock<std::mutex> lock(mutex);
 
-    Side side = Side::SIDE_BACK;
-    int n, w, h;
+    // the blocks here may still be the ones of the position the chunk left,
+    // the load queued by the move rebuilds it once the new ones are in
+    if (generation != this->generation || (flags & FLAG_NEEDS_LOAD)) {
+        return false;
+    }
+
+    // everything the meshers read is taken here, edits made while they run
+    // dirty the layers again and queue another rebuild
+    const uint32 blockFlags = flags;
+    const int32 targetLod = lod;
+    const double meshEditTime = editTime;
+
+    uint64 layers[3];
+    Memory::memcpy(layers, dirtyLayers, sizeof(layers));
+    Memory::memset(dirtyLayers, 0, sizeof(dirtyLayers));
+
+    editTime = -1.0;
+
+    BlockStorage* snapshot = shareBlocks();
+
+    lock.unlock();
+
+    const ChunkBorders& borders = targetLod > 0 ? NO_BORDERS : neighborBorders;
+    refined = targetLod == 0 && meshLod > 0;
+
+    // only full resolution binary meshes keep slices that can be patched
+    if (mesherType != MesherType::BINARY || meshType != MesherType::BINARY
+            || targetLod > 0 || meshLod > 0) {
+        Memory::memcpy(layers, ALL_LAYERS, sizeof(layers));
+    }
+
+    // the border layer facing a neighbor that changed is remeshed as well
+    for (int32 i = 0; i < static_cast<int32>(Side::NUM_SIDES); ++i) {
+        if (Memory::memcmp(borders.rows[i], meshBorders[i],
+                sizeof(meshBorders[i])) != 0) {
+            const Side side = static_cast<Side>(i);
+            const int32 d = get_axis(side);
+
+            layers[d] |= uint64(1) << (side == get_side(d, true)
+                    ? 0 : CHUNK_SIZE - 1);
+
+            // so are the layers next to a changed cell along the border,
+            // the corner AO of their edge faces samples it
+            uint64 changedU = 0;
+            uint64 changedV = 0;
+
+            for (int32 j = 0; j < CHUNK_SIZE; ++j) {
+                const uint64 changed = borders.rows[i][j] ^ meshBorders[i][j];
+
+                changedU |= changed;
+                changedV |= uint64(changed != 0) << j;
+            }
+
+            layers[(d + 1) % 3] |= ((changedU << 1) | (changedU >> 1))
+                    & FULL_COLUMN;
+            layers[(d + 2) % 3] |= ((changedV << 1) | (changedV >> 1))
+                    & FULL_COLUMN;
+        }
+    }
+
+    Memory::memcpy(meshBorders, borders.rows, sizeof(meshBorders));
+
+    uint32 slices[NUM_SLICES + 1] = {};
+
+    // air has no faces of its own, neighbors mesh their side of the border
+    if (!(blockFlags & FLAG_ALL_AIR)) {
+        BlockGrid& grid = *reinterpret_cast<BlockGrid*>(cb.get_block_grid());
+        (snapshot ? *snapshot : AIR_BLOCKS).decode(grid.blocks);
+
+        const bool allSolid = blockFlags & FLAG_ALL_SOLID;
+
+        if (targetLod > 0) {
+            rebuildBinary(cb, grid, allSolid, borders, true, ALL_LAYERS,
+                    slices, targetLod);
+        }
+        else {
+            rebuildWithMesher(cb, grid, allSolid, borders, mesherType,
+                    layers, slices);
+        }
+    }
+
+    if (snapshot) {
+        BlockStorage::release(snapshot);
+    }
+
+    lock.lock();
 
     flags &= ~FLAG_ALL_OCCLUSIONS;
     flags &= ~FLAG_EMPTY;
 
-    Block mask[CHUNK_SIZE * CHUNK_SIZE];
+    if (!(blockFlags & FLAG_ALL_AIR)) {
+        if (targetLod == 0) {
+            updateOcclusionFlags();
+        }
+        // border layers of a LOD mesh only stay closed if nothing was
+        // voted away
+        else if (blockFlags & FLAG_ALL_SOLID) {
+            flags |= FLAG_ALL_OCCLUSIONS;
+        }
+    }
+
+    if (cb.is_empty()) {
+        flags |= FLAG_EMPTY;
+    }
+
+    commitMesh(cb, slices, mesherType, targetLod, meshEditTime);
+
+    cb.set_chunk(this, generation);
+
+    return true;
+}
+
+void Chunk::rebuildWithMesher(ChunkBuilder& cb, const BlockGrid& grid,
+        bool allSolid, const ChunkBorders& borders, MesherType mesherType,
+        const uint64* layers, uint32* slices) {
+    switch (mesherType) {
+        case MesherType::MASK:
+            rebuildMask(cb, grid, borders);
+            break;
+        case MesherType::VALIDATE:
+        {
+            uint32 scratchSlices[NUM_SLICES + 1];
+
+            rebuildBinary(cb, grid, allSolid, borders, true, ALL_LAYERS,
+                    slices);
+
+            ChunkBuilder plain;
+            rebuildBinary(plain, grid, allSolid, borders, false, ALL_LAYERS,
+                    scratchSlices);
+
+            ChunkBuilder reference;
+            rebuildMask(reference, grid, borders);
+
+            if (!plain.has_same_geometry(reference)) {
+                DEBUG_LOG("Chunk", LOG_WARNING,
+                        "Binary mesher mismatch at (%d, %d, %d): "
+                        "%zu/%zu vertices",
+                        position.x, position.y, position.z,
+                        plain.num_vertices(), reference.num_vertices());
+            }
+
+            cb.set_num_plain_quads(plain.num_quads());
+        }
+            break;
+        default:
+            rebuildBinary(cb, grid, allSolid, borders, true, layers, slices);
+    }
+}
+
+void Chunk::rebuildMask(ChunkBuilder& cb, const BlockGrid& grid,
+        const ChunkBorders& borders) {
+    const auto& registry = BlockRegistry::getInstance();
+
+    Side side = Side::SIDE_BACK;
+    int n, w, h;
+
+    Block* mask = cb.get_face_mask();
 
     // TODO: do not push unrendered interior faces
     for (bool backFace = true, b = false; b != backFace;
@@ -99,35 +614,45 @@ void Chunk::rebuild(Memory::SharedPointer<ChunkBuilder> cb) {
                     break;
             }
 
+            const uint64* neighborRows = borders.rows[static_cast<int32>(side)];
+
             for (x[d] = -1; x[d] < CHUNK_SIZE;) {
                 n = 0;
 
                 for (x[v] = 0; x[v] < CHUNK_SIZE; ++x[v]) {
                     for (x[u] = 0; x[u] < CHUNK_SIZE; ++x[u]) {
                         auto& block = mask[n++];
-                        Block b0, b1;
-
+                        const Block* b0 = &AIR_BLOCK;
+                        const Block* b1 = &AIR_BLOCK;
+                        bool opaque0 = false;
+                        bool opaque1 = false;
+
+                        // neighbor blocks only cull faces, the faces they
+                        // own themselves are meshed by the neighbor. The
+                        // blocks are read in place, a packed copy would be
+                        // stored and loaded again for every lookup
                         if (x[d] >= 0) {
-                            b0 = blocks[x.x][x.y][x.z];
+                            b0 = &grid(x.x, x.y, x.z);
+                            opaque0 = is_opaque(registry, *b0);
+                        }
+                        else if (backFace) {
+                            opaque0 = (neighborRows[x[v]] >> x[u]) & 1;
                         }
 
                         if (x[d] < CHUNK_SIZE - 1) {
-                            b1 = blocks[x.x + q.x][x.y + q.y][x.z + q.z];
+                            b1 = &grid(x.x + q.x, x.y + q.y, x.z + q.z);
+                            opaque1 = is_opaque(registry, *b1);
+                        }
+                        else if (!backFace) {
+                            opaque1 = (neighborRows[x[v]] >> x[u]) & 1;
                         }
 
-                        block.set_active(!(b0.is_active() && b1.is_active()
-                                /*&& b0.get_type() == b1.get_type()*/));
+                        // the face belongs to the block it is in front of
+                        const Block& owner = backFace ? *b1 : *b0;
 
-                        if (block.is_active()) {
-                            if (backFace) {
-                                block.set_type(b1.get_type());
-                                block.set_active(b1.is_active());
-                            }
-                            else {
-                                block.set_type(b0.get_type());
-                                block.set_active(b0.is_active());
-                            }
-                        }
+                        block = Block(is_meshed(registry, owner)
+                                && !(backFace ? opaque0 : opaque1),
+                                owner.get_type());
                     }
                 }
 
@@ -167,8 +692,8 @@ void Chunk::rebuild(Memory::SharedPointer<ChunkBuilder> cb) {
                                 du[u] = w;
                                 dv[v] = h;
 
-                                cb->add_quad(x, x + du, x + du + dv, x + dv,
-                                        mask[n], side, backFace);
+                                cb.add_quad(x, x + du, x + du + dv, x + dv,
+                                        mask[n].get_type(), side, backFace);
                             //}
 
                             for (int l = 0; l < h; ++l) {
@@ -186,64 +711,508 @@ void Chunk::rebuild(Memory::SharedPointer<ChunkBuilder> cb) {
                         }
                     }
                 }
+            }
+        }
+    }
+}
+
+void Chunk::rebuildBinary(ChunkBuilder& cb, const BlockGrid& grid,
+        bool allSolid, const ChunkBorders& borders, bool ambientOcclusion,
+        const uint64* layers, uint32* slices, int32 lod) {
+    // a LOD mesh works on cells of scale^3 blocks, size cells per axis
+    const int32 size = CHUNK_SIZE >> lod;
+    const int32 scale = 1 << lod;
+
+    const auto& registry = BlockRegistry::getInstance();
+
+    // meshed[d][v][u] holds one bit per cell along axis d and opaque[d][v][u]
+    // the cells among them that hide their neighbors, so visible faces are
+    // found for a whole column with a shift and an and-not
+    typedef BitColumn ColumnGrid[3][CHUNK_SIZE][CHUNK_SIZE];
+    typedef BlockType CellGrid[CHUNK_SIZE / 2][CHUNK_SIZE / 2][CHUNK_SIZE / 2];
+
+    ColumnGrid& meshed = *reinterpret_cast<ColumnGrid*>(cb.get_column_grid());
+    ColumnGrid& opaque = *(&meshed + 1);
+    CellGrid& cells = *reinterpret_cast<CellGrid*>(cb.get_cell_grid());
+
+    const auto getType = [&](const Vector3i& x) {
+        return lod > 0 ? cells[x.x][x.y][x.z] : grid(x.x, x.y, x.z).get_type();
+    };
+
+    if (lod > 0) {
+        Memory::memset(meshed, 0, sizeof(meshed));
+        Memory::memset(opaque, 0, sizeof(opaque));
+
+        for (int32 x = 0; x < size; ++x) {
+            for (int32 y = 0; y < size; ++y) {
+                for (int32 z = 0; z < size; ++z) {
+                    const BlockType type = getCellType(grid,
+                            Vector3i(x, y, z), lod);
+                    cells[x][y][z] = type;
+
+                    const BitColumn cellMeshed = type != BlockType::AIR
+                            && registry.is_meshed(type);
+                    const BitColumn cellOpaque = type != BlockType::AIR
+                            && registry.is_opaque(type);
+
+                    meshed[0][z][y] |= cellMeshed << x;
+                    meshed[1][x][z] |= cellMeshed << y;
+                    meshed[2][y][x] |= cellMeshed << z;
+
+                    opaque[0][z][y] |= cellOpaque << x;
+                    opaque[1][x][z] |= cellOpaque << y;
+                    opaque[2][y][x] |= cellOpaque << z;
+                }
+            }
+        }
+    }
+    else if (allSolid) {
+        // only the faces on the chunk border survive the column test
+        for (auto& row : meshed[0]) {
+            for (auto& column : row) {
+                column = FULL_COLUMN;
+            }
+        }
+
+        Memory::memcpy(meshed[1], meshed[0], sizeof(meshed[0]));
+        Memory::memcpy(meshed[2], meshed[0], sizeof(meshed[0]));
+        Memory::memcpy(opaque, meshed, sizeof(opaque));
+    }
+    else {
+        Memory::memset(meshed, 0, sizeof(meshed));
+        Memory::memset(opaque, 0, sizeof(opaque));
+
+        forEachBlock([&](const Vector3i& pos, uint32 index) {
+            const Block& block = grid.blocks[index];
+            const BitColumn blockMeshed = is_meshed(registry, block);
+            const BitColumn blockOpaque = is_opaque(registry, block);
+
+            meshed[0][pos.z][pos.y] |= blockMeshed << pos.x;
+            meshed[1][pos.x][pos.z] |= blockMeshed << pos.y;
+            meshed[2][pos.y][pos.x] |= blockMeshed << pos.z;
+
+            opaque[0][pos.z][pos.y] |= blockOpaque << pos.x;
+            opaque[1][pos.x][pos.z] |= blockOpaque << pos.y;
+            opaque[2][pos.y][pos.x] |= blockOpaque << pos.z;
+        });
+    }
+
+    // type rows [k][j] of a slot have bit i set for a face of its type on
+    // layer k at (u = i, v = j); rows[k][j] is the union over all types
+    typedef BitColumn FaceRows[CHUNK_SIZE][CHUNK_SIZE];
+    FaceRows& rows = *reinterpret_cast<FaceRows*>(cb.get_face_rows());
+
+    // corner AO of each face, 2 bits per corner in add_quad() order
+    typedef uint8 OcclusionGrid[CHUNK_SIZE][CHUNK_SIZE][CHUNK_SIZE];
+    OcclusionGrid& occlusion = *reinterpret_cast<OcclusionGrid*>(
+            cb.get_occlusion_grid());
+
+    for (int32 pass = 0; pass < 2; ++pass) {
+        const bool backFace = pass == 0;
+
+        for (int32 d = 0; d < 3; ++d) {
+            const int32 u = (d + 1) % 3;
+            const int32 v = (d + 2) % 3;
+
+            const Side side = get_side(d, backFace);
+            const uint64* neighborRows = borders.rows[static_cast<int32>(side)];
+
+            Memory::memset(rows, 0, sizeof(rows));
+
+            Vector3i x(0, 0, 0);
+
+            for (x[v] = 0; x[v] < size; ++x[v]) {
+                for (x[u] = 0; x[u] < size; ++x[u]) {
+                    const BitColumn col = meshed[d][x[v]][x[u]];
+                    const BitColumn cover = opaque[d][x[v]][x[u]];
+                    const BitColumn neighbor = (neighborRows[x[v]] >> x[u]) & 1;
+
+                    BitColumn visible = (backFace
+                            ? (col & ~((cover << 1) | neighbor))
+                            : (col & ~((cover >> 1)
+                            | (neighbor << (size - 1)))))
+                            & layers[d];
+
+                    const BitColumn bit = BitColumn(1) << x[u];
+
+                    while (visible) {
+                        x[d] = __builtin_ctzll(visible);
+                        visible &= visible - 1;
+
+                        const size_t slot = cb.get_type_slot(getType(x));
+
+                        cb.get_type_rows()[(slot * CHUNK_SIZE + x[d])
+                                * CHUNK_SIZE + x[v]] |= bit;
+                        rows[x[d]][x[v]] |= bit;
+
+                        occlusion[x[d]][x[v]][x[u]] = ambientOcclusion
+                                ? get_face_ao(opaque[d], borders, d, size,
+                                x[u], x[v], x[d] + (backFace ? -1 : 1))
+                                : ChunkBuilder::AO_NONE;
+                    }
+                }
+            }
+
+            for (int32 k = 0; k < size; ++k) {
+                const int32 slice = (pass * 3 + d) * CHUNK_SIZE + k;
+                slices[slice] = cb.num_vertices();
+
+                // clean slices are copied from the previous mesh
+                if (!((layers[d] >> k) & 1)) {
+                    cb.add_vertices(meshVertices.data() + meshSlices[slice],
+                            meshSlices[slice + 1] - meshSlices[slice]);
+                    continue;
+                }
+
+                x[d] = k;
+
+                for (int32 j = 0; j < size; ++j) {
+                    while (rows[k][j]) {
+                        const int32 i = __builtin_ctzll(rows[k][j]);
+
+                        x[u] = i;
+                        x[v] = j;
+
+                        const BlockType type = getType(x);
+                        BitColumn* typeRows = cb.get_type_rows()
+                                + (static_cast<size_t>(cb.get_type_slot(type))
+                                * CHUNK_SIZE + k) * CHUNK_SIZE;
+
+                        // cells only merge when their corner AO matches,
+                        // otherwise the lighting would smear across the quad
+                        const uint8 ao = occlusion[k][j][i];
+
+                        const BitColumn run = ~(typeRows[j] >> i);
+                        int32 w = run ? __builtin_ctzll(run) : size - i;
+
+                        for (int32 l = 1; l < w; ++l) {
+                            if (occlusion[k][j][i + l] != ao) {
+                                w = l;
+                                break;
+                            }
+                        }
+
+                        const BitColumn span = (w == 64 ? ~BitColumn(0)
+                                : ((BitColumn(1) << w) - 1)) << i;
+
+                        int32 h = 1;
 
-                if (x[u] == 0 && x[v] == 0 && (x[d] == 0 || x[d] == CHUNK_SIZE)
-                        && w == CHUNK_SIZE && h == CHUNK_SIZE) {
-                    switch (side) {
-                        case Side::SIDE_FRONT:
-                            flags |= FLAG_OCCLUDES_POS_Z;
-                            break;
-                        case Side::SIDE_BACK:
-                            flags |= FLAG_OCCLUDES_NEG_Z;
-                            break;
-                        case Side::SIDE_LEFT:
-                            flags |= FLAG_OCCLUDES_NEG_X;
-                            break;
-                        case Side::SIDE_RIGHT:
-                            flags |= FLAG_OCCLUDES_POS_X;
-                            break;
-                        case Side::SIDE_TOP:
-                            flags |= FLAG_OCCLUDES_POS_Y;
-                            break;
-                        case Side::SIDE_BOTTOM:
-                            flags |= FLAG_OCCLUDES_NEG_Y;
-                            break;
-                        default:
-                            break;
+                        while (j + h < size
+                                && (typeRows[j + h] & span) == span
+                                && Memory::memcmp(&occlusion[k][j][i],
+                                &occlusion[k][j + h][i], w) == 0) {
+                            ++h;
+                        }
+
+                        for (int32 l = 0; l < h; ++l) {
+                            typeRows[j + l] &= ~span;
+                            rows[k][j + l] &= ~span;
+                        }
+
+                        Vector3i p = x;
+                        Vector3i du(0, 0, 0);
+                        Vector3i dv(0, 0, 0);
+
+                        p[d] += !backFace;
+                        du[u] = w;
+                        dv[v] = h;
+
+                        p *= scale;
+                        du *= scale;
+                        dv *= scale;
+
+                        cb.add_quad(p, p + du, p + du + dv, p + dv,
+                                type, side, backFace, ao);
                     }
                 }
             }
+
+            cb.reset_type_slots();
         }
     }
 
-    if (cb->is_empty()) {
-        flags |= FLAG_EMPTY;
+    slices[NUM_SLICES] = cb.num_vertices();
+}
+
+void Chunk::commitMesh(ChunkBuilder& cb, const uint32* slices,
+        MesherType mesherType, int32 lod, double meshEditTime) {
+    const auto& vertices = cb.get_vertices();
+    const uint32 numVertices = static_cast<uint32>(vertices.size());
+    const uint32 numCommon = Math::min(numVertices,
+            static_cast<uint32>(meshVertices.size()));
+
+    // only the range that differs from the previous mesh is uploaded, a
+    // resized mesh shifts everything after its first change
+    uint32 begin = 0;
+    uint32 end = numVertices;
+
+    while (begin < numCommon && vertices[begin] == meshVertices[begin]) {
+        ++begin;
+    }
+
+    if (numVertices == meshVertices.size()) {
+        while (end > begin && vertices[end - 1] == meshVertices[end - 1]) {
+            --end;
+        }
+    }
+
+    if (begin < end) {
+        uploadBegin = Math::min(uploadBegin, begin);
+        uploadEnd = Math::max(uploadEnd, end);
+    }
+
+    if (vertices.size() > meshVertices.capacity()) {
+        cb.add_allocation();
+    }
+
+    meshVertices.assign(std::begin(vertices), std::end(vertices));
+    Memory::memcpy(meshSlices, slices, sizeof(meshSlices));
+    meshType = mesherType;
+    meshLod = lod;
+
+    if (meshEditTime >= 0.0) {
+        meshedEditTime = meshedEditTime >= 0.0
+                ? Math::min(meshedEditTime, meshEditTime) : meshEditTime;
+    }
+}
+
+uint32 Chunk::getOcclusionFlag(Side side) noexcept {
+    switch (side) {
+        case Side::SIDE_FRONT:
+            return FLAG_OCCLUDES_POS_Z;
+        case Side::SIDE_BACK:
+            return FLAG_OCCLUDES_NEG_Z;
+        case Side::SIDE_LEFT:
+            return FLAG_OCCLUDES_NEG_X;
+        case Side::SIDE_RIGHT:
+            return FLAG_OCCLUDES_POS_X;
+        case Side::SIDE_TOP:
+            return FLAG_OCCLUDES_POS_Y;
+        case Side::SIDE_BOTTOM:
+            return FLAG_OCCLUDES_NEG_Y;
+        default:
+            return 0;
+    }
+}
+
+bool Chunk::getBorder(const Vector3i& position, Side side, uint64* rows) {
+    std::unique_lock<std::mutex> lock(mutex);
+
+    if (this->position != position || (flags & FLAG_NEEDS_LOAD)
+            || lod > 0 || meshLod > 0) {
+        return false;
+    }
+
+    getLayer(side, rows);
+
+    return true;
+}
+
+void Chunk::getLayer(Side side, uint64* rows) const {
+    const auto& registry = BlockRegistry::getInstance();
+
+    if (flags & FLAG_UNIFORM) {
+        const uint64 row = (flags & FLAG_ALL_SOLID) ? FULL_COLUMN : 0;
+
+        for (int32 i = 0; i < CHUNK_SIZE; ++i) {
+            rows[i] = row;
+        }
+
+        return;
+    }
+
+    const int32 d = get_axis(side);
+    const int32 u = (d + 1) % 3;
+    const int32 v = (d + 2) % 3;
+
+    Vector3i x(0, 0, 0);
+    x[d] = side == get_side(d, true) ? 0 : CHUNK_SIZE - 1;
+
+    for (x[v] = 0; x[v] < CHUNK_SIZE; ++x[v]) {
+        uint64 row = 0;
+
+        for (x[u] = 0; x[u] < CHUNK_SIZE; ++x[u]) {
+            row |= static_cast<uint64>(is_opaque(registry,
+                    getBlocks().get(getIndex(x)))) << x[u];
+        }
+
+        rows[x[v]] = row;
+    }
+}
+
+void Chunk::updateOcclusionFlags() {
+    uint64 rows[CHUNK_SIZE];
+
+    flags &= ~FLAG_ALL_OCCLUSIONS;
+
+    for (int32 i = 0; i < static_cast<int32>(Side::NUM_SIDES); ++i) {
+        const Side side = static_cast<Side>(i);
+        getLayer(side, rows);
+
+        bool solid = true;
+
+        for (int32 j = 0; j < CHUNK_SIZE; ++j) {
+            solid = solid && rows[j] == FULL_COLUMN;
+        }
+
+        if (solid) {
+            flags |= getOcclusionFlag(side);
+        }
+    }
+}
+
+void Chunk::setBlock(const Vector3i& position, bool active,
+        BlockType type) noexcept {
+    flags &= ~FLAG_UNIFORM;
+    flags |= FLAG_MODIFIED;
+
+    if (!(flags & FLAG_COLLAPSED)) {
+        edits[getIndex(position)] = Block(active, type);
+
+        // past this point the whole chunk is smaller on disk, and storing
+        // it keeps the edit map from growing without bound
+        if (edits.size() > static_cast<size_t>(MAX_EDITS)) {
+            flags |= FLAG_COLLAPSED;
+            HashMap<uint32, Block>().swap(edits);
+        }
+    }
+
+    // faces in the layers on either side see the block and its AO
+    for (int32 d = 0; d < 3; ++d) {
+        const uint64 layer = uint64(1) << position[d];
+        dirtyLayers[d] |= (layer | (layer << 1) | (layer >> 1)) & FULL_COLUMN;
+    }
+
+    // air chunks only get storage of their own for their first solid block
+    if (!blocks && !active && type == BlockType::AIR) {
+        return;
+    }
+
+    getWritableBlocks().set(getIndex(position), Block(active, type));
+
+    if (is_meshed(BlockRegistry::getInstance(), Block(active, type))) {
+        blockTree.add(position);
+    }
+    else {
+        blockTree.remove(position);
+    }
+}
+
+void Chunk::markEdited(double time) noexcept {
+    if (editTime < 0.0) {
+        editTime = time;
+    }
+}
+
+bool Chunk::setLod(int32 lod) noexcept {
+    std::unique_lock<std::mutex> lock(mutex);
+
+    if (this->lod == lod) {
+        return false;
+    }
+
+    this->lod = lod;
+
+    return !(flags & FLAG_NEEDS_LOAD);
+}
+
+bool Chunk::setCompressed(bool compressed) noexcept {
+    std::unique_lock<std::mutex> lock(mutex);
+
+    if (this->compressed == compressed) {
+        return false;
+    }
+
+    this->compressed = compressed;
+
+    return !(flags & FLAG_NEEDS_LOAD) && blocks;
+}
+
+bool Chunk::isCompressed() const noexcept {
+    std::unique_lock<std::mutex> lock(mutex);
+
+    return compressed;
+}
+
+void Chunk::updateCompression() {
+    std::unique_lock<std::mutex> lock(mutex);
+
+    if ((flags & FLAG_NEEDS_LOAD) || !blocks
+            || blocks->is_compressed() == compressed) {
+        return;
     }
 
-    cb->set_chunk(this);
+    // a shared storage is copied first, a rebuild may be reading it
+    if (compressed) {
+        getWritableBlocks().compress();
+    }
+    else {
+        getWritableBlocks().decompress();
+    }
+}
+
+BlockType Chunk::getCellType(const BlockGrid& grid, const Vector3i& cell,
+        int32 lod) noexcept {
+    const int32 scale = 1 << lod;
+    const Vector3i origin = cell * scale;
+
+    int32 numSolid = 0;
+    BlockType type = BlockType::AIR;
+
+    // the cell takes the type of its highest block, which keeps grass on
+    // top of downsampled terrain
+    for (int32 y = scale - 1; y >= 0; --y) {
+        for (int32 x = 0; x < scale; ++x) {
+            for (int32 z = 0; z < scale; ++z) {
+                const Block& block = grid(origin.x + x, origin.y + y,
+                        origin.z + z);
+
+                if (block.is_active()) {
+                    if (type == BlockType::AIR) {
+                        type = block.get_type();
+                    }
+
+                    ++numSolid;
+                }
+            }
+        }
+    }
+
+    // majority vote, ties stay solid so thin surfaces survive
+    return 2 * numSolid >= scale * scale * scale ? type : BlockType::AIR;
 }
 
 void Chunk::moveTo(const Vector3i& position) noexcept {
     std::unique_lock<std::mutex> lock(mutex);
 
-    flags |= FLAG_NEEDS_REBUILD;
+    flags |= FLAG_NEEDS_REBUILD | FLAG_NEEDS_LOAD;
     this->position = position;
+
+    ++generation;
+}
+
+uint32 Chunk::getGeneration() const noexcept {
+    return generation;
 }
 
 void Chunk::setRebuilt() noexcept {
     flags &= ~FLAG_NEEDS_REBUILD;
 }
 
-Block& Chunk::get(uint32 x, uint32 y, uint32 z) noexcept {
-    return blocks[x][y][z];
+Block Chunk::get(uint32 x, uint32 y, uint32 z) const noexcept {
+    return get(Vector3i(x, y, z));
 }
 
-Block& Chunk::get(const Vector3i& position) noexcept {
-    return blocks[position.x][position.y][position.z];
+Block Chunk::get(const Vector3i& position) const noexcept {
+    std::unique_lock<std::mutex> lock(mutex);
+
+    return getBlocks().get(getIndex(position));
 }
 
-const Block& Chunk::get(const Vector3i& position) const noexcept {
-    return blocks[position.x][position.y][position.z];
+size_t Chunk::getBlockMemory() const noexcept {
+    std::unique_lock<std::mutex> lock(mutex);
+
+    return blocks ? blocks->get_memory_usage() : 0;
 }
 
 VertexArray& Chunk::getVertexArray() noexcept {
@@ -286,6 +1255,12 @@ bool Chunk::needsRebuild() const noexcept {
     return flags & FLAG_NEEDS_REBUILD;
 }
 
+bool Chunk::needsLoad() const noexcept {
+    std::unique_lock<std::mutex> lock(mutex);
+
+    return flags & FLAG_NEEDS_LOAD;
+}
+
 bool Chunk::shouldRender() const noexcept {
     return !isEmpty() && !needsRebuild();
 }
@@ -302,7 +1277,46 @@ const BlockTreeNode& Chunk::getBlockTree() const noexcept {
     return blockTree;
 }
 
+const BlockStorage& Chunk::getBlocks() const noexcept {
+    return blocks ? *blocks : AIR_BLOCKS;
+}
+
+void Chunk::releaseBlocks() noexcept {
+    if (blocks) {
+        BlockStorage::release(blocks);
+        blocks = nullptr;
+    }
+}
+
+BlockStorage* Chunk::shareBlocks() const noexcept {
+    if (blocks) {
+        blocks->add_reference();
+    }
+
+    return blocks;
+}
+
+BlockStorage& Chunk::getWritableBlocks(bool keepBlocks) {
+    if (blocks && blocks->is_shared()) {
+        BlockStorage* copy = BlockStorage::acquire(NUM_BLOCKS);
+
+        if (keepBlocks) {
+            copy->assign(*blocks);
+        }
+
+        BlockStorage::release(blocks);
+        blocks = copy;
+    }
+    else if (!blocks) {
+        blocks = BlockStorage::acquire(NUM_BLOCKS);
+    }
+
+    return *blocks;
+}
+
 Chunk::~Chunk() {
+    releaseBlocks();
+
     if (vertexArray) {
         delete vertexArray;
     }
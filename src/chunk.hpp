@@ -1,41 +1,141 @@
 #pragma once
 
 #include "block.hpp"
+#include "block-storage.hpp"
 
 #include "chunk-builder.hpp"
 
 #include "block-tree.hpp"
+#include "morton.hpp"
 
 #include <engine/core/common.hpp>
 #include <engine/core/memory.hpp>
+#include <engine/core/array-list.hpp>
+#include <engine/core/hash-map.hpp>
 
+#include <atomic>
 #include <mutex>
 
+// chunk edge length in blocks, set per build with -DVOXEL_CHUNK_SIZE, see
+// CHUNK_SIZE in the Makefile
+#ifndef VOXEL_CHUNK_SIZE
+    #define VOXEL_CHUNK_SIZE 16
+#endif
+
+// blocks are stored in Z-order when VOXEL_MORTON_BLOCKS is defined, in
+// x-major [x][y][z] order otherwise, see BLOCK_LAYOUT in the Makefile
+
 class RenderContext;
 class VertexArray;
 class IndexedModel;
 class TerrainGenerator;
 
+struct ChunkBorders;
+
+enum class MesherType {
+    MASK = 0, // reference mesher, builds a Block mask per slice
+    BINARY,   // bitmask columns with per-type greedy merging on bit rows,
+              // bakes per-vertex ambient occlusion
+    VALIDATE, // runs BINARY, checks it against MASK with AO disabled and
+              // records the plain quad count
+
+    NUM_TYPES
+};
+
 class Chunk final {
     public:
-        static constexpr const int32 CHUNK_SIZE = 16;
+        static constexpr const int32 CHUNK_SIZE = VOXEL_CHUNK_SIZE;
+        static constexpr const int32 CHUNK_SIZE_SHIFT = CHUNK_SIZE == 64 ? 6
+                : CHUNK_SIZE == 32 ? 5 : 4;
+        static constexpr const int32 NUM_BLOCKS
+                = CHUNK_SIZE * CHUNK_SIZE * CHUNK_SIZE;
         static constexpr const float BLOCK_RENDER_SIZE = 0.5f;
 
+        // one slice per side and layer, in the order the mesher emits them
+        static constexpr const int32 NUM_SLICES
+                = static_cast<int32>(Side::NUM_SIDES) * CHUNK_SIZE;
+
+        // LOD n meshes cells of 2^n blocks per axis
+        static constexpr const int32 NUM_LODS = 3;
+
+        // chunks are saved as their edits over the generated terrain until
+        // they have more than this many, and as a whole from then on
+        static constexpr const int32 MAX_EDITS = NUM_BLOCKS / 64;
+
+        static_assert(CHUNK_SIZE == 1 << CHUNK_SIZE_SHIFT,
+                "VOXEL_CHUNK_SIZE must be 16, 32 or 64");
+
         Chunk();
 
-        void init(RenderContext& context, const IndexedModel& model);
+        void init(RenderContext& context, const IndexedModel& model,
+                VertexArray& quadIndices);
+
+        // both loads are for the chunk at position in the given generation
+        // and leave a chunk that has moved on since alone, its own load is
+        // queued by the move
+        void load(const Vector3i& position, uint32 generation,
+                TerrainGenerator& terrainGenerator);
+        // loads data written by save(), edits are applied over the terrain
+        // generated for the chunk. Returns false when the data is malformed
+        // and the chunk has to be generated
+        bool load(const Vector3i& position, uint32 generation,
+                const uint8* data, size_t size,
+                TerrainGenerator& terrainGenerator);
+
+        // true for data save() wrote as edits, which load() generates the
+        // terrain for, false for whole blocks, which it only reads in
+        static bool isEditSave(const uint8* data, size_t size) noexcept;
 
-        void load(TerrainGenerator& terrainGenerator);
-        void rebuild(Memory::SharedPointer<ChunkBuilder> chunkBuilder);
+        // appends the edits or, once they were collapsed, the blocks to data
+        // when there were edits since the chunk was loaded or last saved,
+        // returns false when there is nothing to save
+        bool save(ArrayList<uint8>& data);
 
+        // meshes a snapshot of the blocks, the mutex is only held to take it
+        // and to commit the mesh, so edits and draws do not wait on meshing.
+        // Returns false without meshing when the chunk has moved on from
+        // generation or its blocks are not loaded yet. refined is set when
+        // the mesh went back to full resolution, so neighbors can cull their
+        // borders against it again
+        bool rebuild(ChunkBuilder& chunkBuilder,
+                const ChunkBorders& borders, uint32 generation, bool& refined,
+                MesherType mesherType = MesherType::BINARY);
+
+        // returns false when neighbors must not cull against this chunk:
+        // it moved, is not loaded yet, or is drawn at a lower LOD, which
+        // keeps its own borders closed so the two meshes cannot crack
+        bool getBorder(const Vector3i& position, Side side, uint64* rows);
+
+        // returns true when a loaded chunk needs a rebuild for the new LOD
+        bool setLod(int32 lod) noexcept;
+
+        // far chunks keep their blocks compressed, see
+        // BlockStorage::compress(). Returns true when the storage of a
+        // loaded chunk has to change, which updateCompression() does
+        bool setCompressed(bool compressed) noexcept;
+        bool isCompressed() const noexcept;
+        void updateCompression();
+
+        void setBlock(const Vector3i& position, bool active,
+                BlockType type) noexcept;
+        void markEdited(double time) noexcept;
+
+        // bumps the generation, jobs queued for an older one are for a
+        // position the chunk has left
         void moveTo(const Vector3i& position) noexcept;
+        uint32 getGeneration() const noexcept;
 
         void setRebuilt() noexcept;
 
-        Block& get(uint32 x, uint32 y, uint32 z) noexcept;
-        Block& get(const Vector3i& position) noexcept;
+        // take the mutex, as the storage may be compressed or expanded by
+        // another thread at any time
+        Block get(uint32 x, uint32 y, uint32 z) const noexcept;
+        Block get(const Vector3i& position) const noexcept;
 
-        const Block& get(const Vector3i& position) const noexcept;
+        // bytes held by the palette compressed block storage, less while
+        // it is compressed, 0 for air chunks, which all read one shared
+        // storage
+        size_t getBlockMemory() const noexcept;
 
         VertexArray& getVertexArray() noexcept;
 
@@ -50,11 +150,14 @@ class Chunk final {
 
         bool isEmpty() const noexcept;
         bool needsRebuild() const noexcept;
+        // moved since its blocks were last loaded
+        bool needsLoad() const noexcept;
 
         bool shouldRender() const noexcept;
 
         std::mutex& getMutex() noexcept;
 
+        // the meshed blocks, which are the ones rays can hit
         BlockTreeNode& getBlockTree() noexcept;
         const BlockTreeNode& getBlockTree() const noexcept;
 
@@ -73,17 +176,183 @@ class Chunk final {
             FLAG_ALL_OCCLUSIONS = 63,
 
             FLAG_EMPTY          = 64,
-            FLAG_NEEDS_REBUILD  = 128
+            FLAG_NEEDS_REBUILD  = 128,
+            FLAG_NEEDS_LOAD     = 256,
+
+            // set by load() when every block is air or every block is solid
+            // and opaque, cleared again by the first setBlock()
+            FLAG_ALL_AIR        = 512,
+            FLAG_ALL_SOLID      = 1024,
+            FLAG_UNIFORM        = 1536,
+
+            // edited since the last load() or save()
+            FLAG_MODIFIED       = 2048,
+            // edits went past MAX_EDITS, the block storage is saved instead
+            FLAG_COLLAPSED      = 4096
         };
 
-        Block blocks[CHUNK_SIZE][CHUNK_SIZE][CHUNK_SIZE];
+        // decoded copy of the blocks in storage order, built once per
+        // rebuild for the meshers in the ChunkBuilder scratch grid
+        struct BlockGrid {
+            Block blocks[NUM_BLOCKS];
+
+            const Block& operator()(int32 x, int32 y,
+                    int32 z) const noexcept {
+                return blocks[getIndex(x, y, z)];
+            }
+        };
+
+        // null while the chunk holds nothing but air
+        BlockStorage* blocks;
+        // blocks set since the terrain was generated by storage index,
+        // empty once collapsed
+        HashMap<uint32, Block> edits;
         VertexArray* vertexArray;
         Vector3i position;
+        // read without the mutex by the job queues, which must not wait
+        // out a load
+        std::atomic<uint32> generation;
         uint32 flags;
 
-        std::mutex mutex;
+        int32 lod;
+        // kept across loads, unlike flags
+        bool compressed;
+
+        mutable std::mutex mutex;
+        // held by rebuild() throughout, one builder meshes the chunk at a
+        // time, guards the mesh state below but meshVertices, which the
+        // mutex guards as well for the upload
+        std::mutex meshMutex;
 
         BlockTreeNode blockTree;
 
+        // last mesh built for this chunk, unchanged slices are copied from
+        // it when only some layers are dirty
+        ArrayList<ChunkVertex> meshVertices;
+        uint32 meshSlices[NUM_SLICES + 1];
+        MesherType meshType;
+        int32 meshLod;
+        uint64 meshBorders[static_cast<int32>(Side::NUM_SIDES)][CHUNK_SIZE];
+
+        // one bit per layer along each axis that has to be remeshed
+        uint64 dirtyLayers[3];
+
+        // vertex range of meshVertices not uploaded yet
+        uint32 uploadBegin;
+        uint32 uploadEnd;
+
+        // time of the oldest edit not yet meshed and not yet uploaded,
+        // negative when there is none
+        double editTime;
+        double meshedEditTime;
+
+        static uint32 getOcclusionFlag(Side side) noexcept;
+
+        // expect the mutex to be held
+        void generate(TerrainGenerator& terrainGenerator);
+        bool loadEdits(const uint8* data, size_t size,
+                TerrainGenerator& terrainGenerator);
+        bool loadBlocks(const uint8* data, size_t size);
+
+        // allSolid and dirtyLayers describe the snapshot being meshed, not
+        // the blocks of the chunk, which may have changed since
+        void rebuildWithMesher(ChunkBuilder& chunkBuilder,
+                const BlockGrid& grid, bool allSolid,
+                const ChunkBorders& borders, MesherType mesherType,
+                const uint64* dirtyLayers, uint32* slices);
+        void rebuildMask(ChunkBuilder& chunkBuilder, const BlockGrid& grid,
+                const ChunkBorders& borders);
+        void rebuildBinary(ChunkBuilder& chunkBuilder, const BlockGrid& grid,
+                bool allSolid, const ChunkBorders& borders,
+                bool ambientOcclusion, const uint64* dirtyLayers,
+                uint32* slices, int32 lod = 0);
+
+        // expects the mutex to be held, meshEditTime is the oldest edit in
+        // the snapshot
+        void commitMesh(ChunkBuilder& chunkBuilder,
+                const uint32* slices, MesherType mesherType, int32 lod,
+                double meshEditTime);
+
+        static BlockType getCellType(const BlockGrid& grid,
+                const Vector3i& cell, int32 lod) noexcept;
+        static uint32 getIndex(int32 x, int32 y, int32 z) noexcept;
+        static uint32 getIndex(const Vector3i& position) noexcept;
+        static Vector3i getBlockPosition(uint32 index) noexcept;
+
+        // calls func(position, index) for every block in storage order,
+        // which walks memory front to back under either layout
+        template <typename Func>
+        static void forEachBlock(Func&& func);
+
+        // the shared air storage when the chunk has none of its own
+        const BlockStorage& getBlocks() const noexcept;
+        void releaseBlocks() noexcept;
+
+        // expect the mutex to be held. shareBlocks() returns the current
+        // blocks with a reference added, null for air, to be let go of with
+        // BlockStorage::release(). getWritableBlocks() copies them first
+        // while they are shared, or starts from air without keepBlocks
+        BlockStorage* shareBlocks() const noexcept;
+        BlockStorage& getWritableBlocks(bool keepBlocks = true);
+
+        // one bit per opaque block, which is all neighbors cull against
+        void getLayer(Side side, uint64* rows) const;
+        void updateOcclusionFlags();
+
         friend class ChunkManager;
+        friend class ChunkBuilder;
+};
+
+inline uint32 Chunk::getIndex(int32 x, int32 y, int32 z) noexcept {
+#ifdef VOXEL_MORTON_BLOCKS
+    return Morton::encode(x, y, z);
+#else
+    return (x << (2 * CHUNK_SIZE_SHIFT)) | (y << CHUNK_SIZE_SHIFT) | z;
+#endif
+}
+
+inline uint32 Chunk::getIndex(const Vector3i& position) noexcept {
+    return getIndex(position.x, position.y, position.z);
+}
+
+inline Vector3i Chunk::getBlockPosition(uint32 index) noexcept {
+#ifdef VOXEL_MORTON_BLOCKS
+    uint32 x, y, z;
+    Morton::decode(index, x, y, z);
+
+    return Vector3i(x, y, z);
+#else
+    constexpr const uint32 MASK = CHUNK_SIZE - 1;
+
+    return Vector3i(index >> (2 * CHUNK_SIZE_SHIFT),
+            (index >> CHUNK_SIZE_SHIFT) & MASK, index & MASK);
+#endif
+}
+
+template <typename Func>
+inline void Chunk::forEachBlock(Func&& func) {
+#ifdef VOXEL_MORTON_BLOCKS
+    for (uint32 i = 0; i < NUM_BLOCKS; ++i) {
+        uint32 x, y, z;
+        Morton::decode(i, x, y, z);
+
+        func(Vector3i(x, y, z), i);
+    }
+#else
+    uint32 i = 0;
+
+    for (int32 x = 0; x < CHUNK_SIZE; ++x) {
+        for (int32 y = 0; y < CHUNK_SIZE; ++y) {
+            for (int32 z = 0; z < CHUNK_SIZE; ++z) {
+                func(Vector3i(x, y, z), i++);
+            }
+        }
+    }
+#endif
+}
+
+// Solid bits of the face-adjacent neighbor layers touching a chunk, indexed
+// by Side with one row per v and one bit per u of that side's axis
+struct ChunkBorders {
+    uint64 rows[static_cast<int32>(Side::NUM_SIDES)][Chunk::CHUNK_SIZE];
 };
@@ -54,6 +54,7 @@ typedef uintptr_t uintptr;
 
 #define LOG_ERROR "Error"
 #define LOG_WARNING "Warning"
+#define LOG_INFO "Info"
 
 #define DEBUG_LOG(category, level, message, ...) \
 	fprintf(stderr, "[%s] ", category); \
@@ -0,0 +1,5 @@
+#pragma once
+
+#include <deque>
+
+#define Deque std::deque
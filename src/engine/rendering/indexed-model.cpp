@@ -15,6 +15,7 @@ static float clipTriangle(Vector3f& centroidSum, const Vector3f& p,
 
 IndexedModel::IndexedModel(const AllocationHints& hints)
 		: instancedElementStartIndex(hints.instancedElementStartIndex)
+		, integralElements(0)
 		, flags(hints.flags) {
 	elementSizes.assign(hints.elementSizes.begin(), hints.elementSizes.end());
 	elements.resize(hints.elementSizes.size());
@@ -19,6 +19,7 @@ class IndexedModel {
 
 		inline IndexedModel()
 				: instancedElementStartIndex((uint32)-1)
+				, integralElements(0)
 				, flags(0) {}
 
 		IndexedModel(const AllocationHints& hints);
@@ -31,7 +32,7 @@ class IndexedModel {
 
 		void initStaticMesh();
 
-		inline void allocateElement(uint32 elementSize);
+		inline void allocateElement(uint32 elementSize, bool integral = false);
 		inline void setInstancedElementStartIndex(uint32 elementIndex);
 
 		void addElement1f(uint32 elementIndex, float e0);
@@ -59,6 +60,7 @@ class IndexedModel {
 		inline uint32 getNumVertices() const;
 		inline uint32 getNumIndices() const;
 		inline uint32 getInstancedElementStartIndex() const;
+		inline uint32 getIntegralElements() const;
 		inline uint32 getFlags() const;
 
 		inline float getElement1f(uint32 elementIndex,
@@ -75,6 +77,7 @@ class IndexedModel {
 		ArrayList<ArrayList<float>> elements;
 
 		uint32 instancedElementStartIndex;
+		uint32 integralElements;
 		uint32 flags;
 };
 
@@ -1,5 +1,9 @@
 
-inline void IndexedModel::allocateElement(uint32 elementSize) {
+inline void IndexedModel::allocateElement(uint32 elementSize, bool integral) {
+	if (integral) {
+		integralElements |= 1 << elementSizes.size();
+	}
+
 	elementSizes.push_back(elementSize);
 	elements.emplace_back();
 }
@@ -51,6 +55,10 @@ inline uint32 IndexedModel::getInstancedElementStartIndex() const {
 	return instancedElementStartIndex;
 }
 
+inline uint32 IndexedModel::getIntegralElements() const {
+	return integralElements;
+}
+
 inline uint32 IndexedModel::getFlags() const {
 	return flags;
 }
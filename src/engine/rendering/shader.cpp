@@ -15,7 +15,8 @@ static void addShaderUniforms(GLuint program,
 		HashMap<String, int32>& uniformMap); 
 
 bool Shader::load(const String& fileName, const char** feedbackVaryings,
-		uintptr numFeedbackVaryings, uint32 varyingCaptureMode) {
+		uintptr numFeedbackVaryings, uint32 varyingCaptureMode,
+		const String& defines) {
 	StringStream ss;
 	
 	if (!Util::loadFileWithLinking(ss, fileName, "#include")) {
@@ -35,7 +36,8 @@ bool Shader::load(const String& fileName, const char** feedbackVaryings,
 	programID = glCreateProgram();
 
 	const String version = "#version " + context->getShaderVersion()
-		+ "\n#define GLSL_VERSION " + context->getShaderVersion();
+		+ "\n#define GLSL_VERSION " + context->getShaderVersion()
+		+ "\n" + defines;
 
 	if (text.find("CS_BUILD") != String::npos) {
 		const String computeShaderText = version
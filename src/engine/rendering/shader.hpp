@@ -18,9 +18,11 @@ class Shader {
 				: context(&context)
 				, programID(0) {}
 
+		// defines are inserted right after the version line of every stage
 		bool load(const String& fileName, const char** feedbackVaryings = nullptr,
 				uintptr numFeedbackVaryings = 0,
-				uint32 varyingCaptureMode = GL_INTERLEAVED_ATTRIBS);
+				uint32 varyingCaptureMode = GL_INTERLEAVED_ATTRIBS,
+				const String& defines = "");
 
 		void setUniformBuffer(const String& name, UniformBuffer& buffer);
 
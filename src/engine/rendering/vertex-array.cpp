@@ -26,12 +26,12 @@ VertexArray::VertexArray(RenderContext& context,
 	if (model.getFlags() & IndexedModel::FLAG_INTERLEAVED_INSTANCES) {
 		initMultiVertexSingleInstance(model.getNumVertexComponents(), 
 				&vertexData[0], model.getNumVertices(),
-				model.getElementSizes(), true);
+				model.getElementSizes(), model.getIntegralElements(), true);
 	}
 	else {
 		initMultiVertexMultiInstance(model.getNumVertexComponents(),
 				&vertexData[0], model.getNumVertices(),
-				model.getElementSizes(), true);
+				model.getElementSizes(), model.getIntegralElements(), true);
 	}
 
 	uintptr indicesSize = numElements * sizeof(uint32);
@@ -66,13 +66,43 @@ VertexArray::VertexArray(RenderContext& context,
 	ArrayList<const float*> vertexData = model.getVertexData();
 	initMultiVertexMultiInstance(model.getNumVertexComponents(),
 			&vertexData[0], model.getNumVertices(), model.getElementSizes(),
-			false);
+			model.getIntegralElements(), false);
 
 	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, buffers[numBuffers - 1]);
 	
 	bufferSizes[numBuffers - 1] = vertexArray.bufferSizes[numBuffers - 1];
 }
 
+VertexArray::VertexArray(RenderContext& context,
+			const IndexedModel& model, uint32 usage, VertexArray& indexSource)
+		: context(&context)
+		, arrayID(0)
+		, numBuffers(model.getNumVertexComponents()
+				+ model.getNumInstanceComponents() + 1)
+		, numElements(0)
+		, instancedComponentStartIndex(model.getInstancedElementStartIndex())
+		, numOwnedBuffers(numBuffers - 1)
+		, buffers(new GLuint[numBuffers])
+		, bufferSizes(new uintptr[numBuffers])
+		, usage(usage)
+		, indexed(true)
+		, bufferOwnership(SHARED_INDEX_BUFFER) {
+	glGenVertexArrays(1, &arrayID);
+	context.setVertexArray(arrayID);
+
+	glGenBuffers(numOwnedBuffers, buffers);
+
+	ArrayList<const float*> vertexData = model.getVertexData();
+	initMultiVertexMultiInstance(model.getNumVertexComponents(),
+			&vertexData[0], model.getNumVertices(), model.getElementSizes(),
+			model.getIntegralElements(), true);
+
+	buffers[numBuffers - 1] = indexSource.buffers[indexSource.numBuffers - 1];
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, buffers[numBuffers - 1]);
+
+	bufferSizes[numBuffers - 1] = indexSource.bufferSizes[indexSource.numBuffers - 1];
+}
+
 VertexArray::VertexArray(RenderContext& context, uint32 numBuffersIn,
 			const uint32* elementSizes, uint32 numElements, uint32 usage,
 			uint32 instancedElementStartIndex, bool indexed)
@@ -189,6 +219,13 @@ void VertexArray::updateBuffer(uint32 bufferIndex,
 	}
 }
 
+void VertexArray::updateBufferRange(uint32 bufferIndex, const void* data,
+		uintptr offset, uintptr dataSize) {
+	context->setVertexArray(arrayID);
+	glBindBuffer(GL_ARRAY_BUFFER, buffers[bufferIndex]);
+	glBufferSubData(GL_ARRAY_BUFFER, offset, dataSize, data);
+}
+
 void VertexArray::updateIndices(const uint32* indices, uint32 numIndices) {
 	context->setVertexArray(arrayID);
 	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, buffers[numBuffers - 1]);
@@ -222,6 +259,11 @@ VertexArray::~VertexArray() {
 				glDeleteBuffers(1, &buffers[numBuffers - 1]);
 			}
 			break;
+		case SHARED_INDEX_BUFFER:
+			glDeleteBuffers(numOwnedBuffers, buffers);
+			break;
+		default:
+			break;
 	}
 	
 	glDeleteVertexArrays(1, &arrayID);
@@ -233,7 +275,8 @@ VertexArray::~VertexArray() {
 
 void VertexArray::initMultiVertexMultiInstance(uint32 numVertexComponents,
 		const float** vertexData, uint32 numVertices,
-		const uint32* vertexElementSizes, bool writeData) {
+		const uint32* vertexElementSizes, uint32 integralElements,
+		bool writeData) {
 	for (uint32 i = 0, attribute = 0; i < numBuffers - 1; ++i) {
 		uint32 attribUsage = usage;
 		bool instancedMode = false;
@@ -256,13 +299,15 @@ void VertexArray::initMultiVertexMultiInstance(uint32 numVertexComponents,
 		
 		bufferSizes[i] = dataSize;
 
-		initDistributedAttribute(elementSize, instancedMode, attribute);
+		initDistributedAttribute(elementSize, instancedMode,
+				(integralElements >> i) & 1, attribute);
 	}
 }
 
 void VertexArray::initMultiVertexSingleInstance(uint32 numVertexComponents,
 		const float** vertexData, uint32 numVertices,
-		const uint32* vertexElementSizes, bool writeData) {
+		const uint32* vertexElementSizes, uint32 integralElements,
+		bool writeData) {
 	uint32 attribute = 0;
 
 	for (uint32 i = 0; i < numVertexComponents; ++i) {
@@ -277,7 +322,8 @@ void VertexArray::initMultiVertexSingleInstance(uint32 numVertexComponents,
 		
 		bufferSizes[i] = dataSize;
 
-		initDistributedAttribute(elementSize, false, attribute);
+		initDistributedAttribute(elementSize, false,
+				(integralElements >> i) & 1, attribute);
 	}
 
 	uint32 instancedDataSize = 0;
@@ -316,7 +362,7 @@ void VertexArray::initEmptyArrayBuffers(uint32 numVertexComponents,
 
 		bufferSizes[i] = dataSize;
 
-		initDistributedAttribute(elementSize, instancedMode, attribute);
+		initDistributedAttribute(elementSize, instancedMode, false, attribute);
 	}
 }
 
@@ -339,7 +385,7 @@ void VertexArray::initSharedBuffers(uint32 numVertexComponents,
 
 		bufferSizes[i] = dataSize;
 
-		initDistributedAttribute(elementSize, false, attribute);
+		initDistributedAttribute(elementSize, false, false, attribute);
 	}
 
 	glBindBuffer(GL_ARRAY_BUFFER, buffers[numVertexComponents]);
@@ -350,15 +396,27 @@ void VertexArray::initSharedBuffers(uint32 numVertexComponents,
 }
 
 inline void VertexArray::initDistributedAttribute(uint32 elementSize,
-		bool instancedMode, uint32& attribute) {
+		bool instancedMode, bool integral, uint32& attribute) {
 	const uint32 elementSizeDiv = elementSize / 4;
 	const uint32 elementSizeRem = elementSize % 4;
 
+	// integral elements are read as 32-bit unsigned ints, which share
+	// the stride math of floats
+	static_assert(sizeof(uint32) == sizeof(float));
+
 	for (uint32 j = 0; j < elementSizeDiv; ++j) {
 		glEnableVertexAttribArray(attribute);
-		glVertexAttribPointer(attribute, 4, GL_FLOAT, GL_FALSE,
-				elementSize * sizeof(float),
-				reinterpret_cast<const void*>(j * 4 * sizeof(float)));
+
+		if (integral) {
+			glVertexAttribIPointer(attribute, 4, GL_UNSIGNED_INT,
+					elementSize * sizeof(float),
+					reinterpret_cast<const void*>(j * 4 * sizeof(float)));
+		}
+		else {
+			glVertexAttribPointer(attribute, 4, GL_FLOAT, GL_FALSE,
+					elementSize * sizeof(float),
+					reinterpret_cast<const void*>(j * 4 * sizeof(float)));
+		}
 
 		if (instancedMode) {
 			glVertexAttribDivisor(attribute, 1);
@@ -369,10 +427,19 @@ inline void VertexArray::initDistributedAttribute(uint32 elementSize,
 
 	if (elementSizeRem != 0) {
 		glEnableVertexAttribArray(attribute);
-		glVertexAttribPointer(attribute, elementSize, GL_FLOAT, GL_FALSE,
-				elementSize * sizeof(float),
-				reinterpret_cast<const void*>(elementSizeDiv * 4
-				* sizeof(float)));
+
+		if (integral) {
+			glVertexAttribIPointer(attribute, elementSize, GL_UNSIGNED_INT,
+					elementSize * sizeof(float),
+					reinterpret_cast<const void*>(elementSizeDiv * 4
+					* sizeof(float)));
+		}
+		else {
+			glVertexAttribPointer(attribute, elementSize, GL_FLOAT, GL_FALSE,
+					elementSize * sizeof(float),
+					reinterpret_cast<const void*>(elementSizeDiv * 4
+					* sizeof(float)));
+		}
 
 		if (instancedMode) {
 			glVertexAttribDivisor(attribute, 1);
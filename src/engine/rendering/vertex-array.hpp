@@ -9,6 +9,8 @@ class VertexArray {
 		VertexArray(RenderContext& context, const IndexedModel& model, uint32 usage);
 		VertexArray(RenderContext& context, const IndexedModel& model,
 				VertexArray& vertexArray);
+		VertexArray(RenderContext& context, const IndexedModel& model,
+				uint32 usage, VertexArray& indexSource);
 
 		/* TODO: this constructor is sorta broken */
 		VertexArray(RenderContext& context, uint32 numBuffers,
@@ -21,8 +23,13 @@ class VertexArray {
 				VertexArray& vertexArray, TransformFeedback& tfb, uint32 bufferNum);
 
 		void updateBuffer(uint32 bufferIndex, const void* data, uintptr dataSize);
+		// the range must lie within the current buffer size
+		void updateBufferRange(uint32 bufferIndex, const void* data,
+				uintptr offset, uintptr dataSize);
 		void updateIndices(const uint32* indices, uint32 numIndices);
 
+		inline void setNumElements(uint32 numElements);
+
 		inline const uint32 getBuffer(uint32 bufferIndex);
 		inline const uintptr getBufferSize(uint32 bufferIndex) const;
 
@@ -39,7 +46,8 @@ class VertexArray {
 			FULLY_OWNED,
 			FULLY_SHARED,
 			SHARED_VERTEX_BUFFERS,
-			SHARED_INSTANCE_BUFFERS
+			SHARED_INSTANCE_BUFFERS,
+			SHARED_INDEX_BUFFER
 		};
 
 		NULL_COPY_AND_ASSIGN(VertexArray);
@@ -64,15 +72,15 @@ class VertexArray {
 		enum BufferOwnership bufferOwnership;
 
 		void initMultiVertexMultiInstance(uint32, const float**, uint32,
-				const uint32*, bool);
+				const uint32*, uint32, bool);
 		void initMultiVertexSingleInstance(uint32, const float**, uint32,
-				const uint32*, bool);
+				const uint32*, uint32, bool);
 
 		void initEmptyArrayBuffers(uint32, uint32, const uint32*);
 		void initSharedBuffers(uint32, const float**, uint32, const uint32*,
 				uint32, const uint32*, uint32, uint32, bool);
 
-		void initDistributedAttribute(uint32, bool, uint32&);
+		void initDistributedAttribute(uint32, bool, bool, uint32&);
 		void initInterleavedAttributes(uint32, uint32, const uint32*, bool, uint32&);
 };
 
@@ -80,6 +88,10 @@ inline const uint32 VertexArray::getBuffer(uint32 bufferIndex) {
 	 return buffers[bufferIndex];
 }
 
+inline void VertexArray::setNumElements(uint32 numElements) {
+	this->numElements = numElements;
+}
+
 inline const uintptr VertexArray::getBufferSize(uint32 bufferIndex) const {
 	return bufferSizes[bufferIndex];
 }
@@ -7,10 +7,10 @@
 class ShaderLoader final : public ResourceLoader<ShaderLoader, Shader> {
 	public:
 		Memory::SharedPointer<Shader> load(RenderContext& renderContext, 
-				const char* fileName) const {
+				const char* fileName, const String& defines = "") const {
 			Memory::SharedPointer<Shader> sh = Memory::make_shared<Shader>(renderContext);
 
-			if (!sh->load(fileName)) {
+			if (!sh->load(fileName, nullptr, 0, GL_INTERLEAVED_ATTRIBS, defines)) {
 				return nullptr;
 			}
 
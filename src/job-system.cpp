@@ -0,0 +1,166 @@
+#include "job-system.hpp"
+
+#include <engine/math/math.hpp>
+
+namespace {
+    // set on the workers, so the jobs they submit stay on their own deques
+    thread_local const JobSystem* currentSystem = nullptr;
+    thread_local uint32 currentWorker = 0;
+};
+
+JobSystem::JobSystem(uint32 numWorkers)
+        : workers(new Worker[Math::max(numWorkers, 1u)])
+        , numWorkers(Math::max(numWorkers, 1u))
+        , nextWorker(0)
+        , numQueuedJobs(0)
+        , running(true) {
+    for (uint32 i = 0; i < this->numWorkers; ++i) {
+        workers[i].rng.seed(i + 1);
+        workers[i].thread = std::thread([this, i]() { run_jobs(i); });
+    }
+}
+
+void JobSystem::submit(Job&& job, JobPriority priority) {
+    if (!running) {
+        return;
+    }
+
+    const bool fromWorker = currentSystem == this;
+    const uint32 workerIndex = fromWorker ? currentWorker
+            : nextWorker++ % numWorkers;
+
+    Worker& worker = workers[workerIndex];
+
+    std::unique_lock<std::mutex> lock(worker.mutex);
+
+    Deque<Job>& jobs = worker.jobs[static_cast<int32>(priority)];
+
+    if (fromWorker) {
+        jobs.push_back(std::move(job));
+    }
+    else {
+        jobs.push_front(std::move(job));
+    }
+
+    lock.unlock();
+
+    // counted under the sleep mutex, so a worker cannot check the count
+    // before this and miss the notify after it
+    std::unique_lock<std::mutex> sleepLock(sleepMutex);
+    ++numQueuedJobs;
+    sleepLock.unlock();
+
+    jobQueued.notify_one();
+}
+
+uint32 JobSystem::get_num_workers() const noexcept {
+    return numWorkers;
+}
+
+uint32 JobSystem::get_num_queued_jobs() const noexcept {
+    return static_cast<uint32>(Math::max(numQueuedJobs.load(), 0));
+}
+
+void JobSystem::stop() {
+    std::unique_lock<std::mutex> sleepLock(sleepMutex);
+    running = false;
+    sleepLock.unlock();
+
+    jobQueued.notify_all();
+
+    for (uint32 i = 0; i < numWorkers; ++i) {
+        if (workers[i].thread.joinable()) {
+            workers[i].thread.join();
+        }
+    }
+
+    for (uint32 i = 0; i < numWorkers; ++i) {
+        std::lock_guard<std::mutex> lock(workers[i].mutex);
+
+        for (auto& jobs : workers[i].jobs) {
+            jobs.clear();
+        }
+    }
+
+    numQueuedJobs = 0;
+}
+
+JobSystem::~JobSystem() {
+    stop();
+
+    delete[] workers;
+}
+
+void JobSystem::run_jobs(uint32 workerIndex) {
+    currentSystem = this;
+    currentWorker = workerIndex;
+
+    Job job;
+
+    while (true) {
+        std::unique_lock<std::mutex> sleepLock(sleepMutex);
+
+        jobQueued.wait(sleepLock, [this]() {
+            return numQueuedJobs > 0 || !running;
+        });
+
+        if (!running) {
+            break;
+        }
+
+        sleepLock.unlock();
+
+        if (take_job(workerIndex, job)) {
+            job();
+
+            // lets go of what the job captured before the worker sleeps
+            job = nullptr;
+        }
+    }
+}
+
+bool JobSystem::take_job(uint32 workerIndex, Job& job) {
+    Worker& worker = workers[workerIndex];
+
+    for (int32 priority = 0;
+            priority < static_cast<int32>(JobPriority::NUM_PRIORITIES);
+            ++priority) {
+        {
+            std::lock_guard<std::mutex> lock(worker.mutex);
+            Deque<Job>& jobs = worker.jobs[priority];
+
+            if (!jobs.empty()) {
+                job = std::move(jobs.back());
+                jobs.pop_back();
+                --numQueuedJobs;
+
+                return true;
+            }
+        }
+
+        const uint32 firstVictim = worker.rng() % numWorkers;
+
+        for (uint32 i = 0; i < numWorkers; ++i) {
+            const uint32 victimIndex = (firstVictim + i) % numWorkers;
+
+            if (victimIndex == workerIndex) {
+                continue;
+            }
+
+            Worker& victim = workers[victimIndex];
+
+            std::lock_guard<std::mutex> lock(victim.mutex);
+            Deque<Job>& jobs = victim.jobs[priority];
+
+            if (!jobs.empty()) {
+                job = std::move(jobs.front());
+                jobs.pop_front();
+                --numQueuedJobs;
+
+                return true;
+            }
+        }
+    }
+
+    return false;
+}
@@ -0,0 +1,80 @@
+#pragma once
+
+#include <engine/core/common.hpp>
+#include <engine/core/deque.hpp>
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <random>
+#include <thread>
+
+enum class JobPriority {
+    HIGH = 0, // edits and rebuilds, which the player is waiting to see
+    LOW,      // loads and compression, only run while no HIGH job is queued
+
+    NUM_PRIORITIES
+};
+
+// A fixed pool of worker threads with a deque of jobs per worker and
+// priority. Jobs submitted from other threads are dealt to the workers in
+// turn and run in the order they came in, a job a worker submits itself
+// goes to the other end of its deque and runs next, while the blocks it
+// follows up on are still in the cache. A worker whose deques are empty
+// steals the job their owner would get to last from a random other worker,
+// so no core idles while one chunk's work queues up behind another.
+//
+// Every HIGH job queued on any worker runs before any LOW one. Workers
+// sleep on a condition variable while nothing is queued, so an idle pool
+// takes no CPU time, and submit() wakes one of them.
+class JobSystem {
+    public:
+        using Job = std::function<void()>;
+
+        // at least one worker
+        explicit JobSystem(uint32 numWorkers);
+
+        void submit(Job&& job, JobPriority priority = JobPriority::HIGH);
+
+        uint32 get_num_workers() const noexcept;
+
+        // jobs queued but not started yet
+        uint32 get_num_queued_jobs() const noexcept;
+
+        // drops the queued jobs and waits for the running ones to finish,
+        // jobs submitted afterwards are dropped as well
+        void stop();
+
+        ~JobSystem();
+    private:
+        NULL_COPY_AND_ASSIGN(JobSystem);
+
+        struct Worker {
+            // front holds the jobs submitted from other threads, the back
+            // the ones the worker submitted itself
+            Deque<Job> jobs[static_cast<int32>(JobPriority::NUM_PRIORITIES)];
+            std::mutex mutex;
+
+            // picks the workers to steal from, only used by the worker
+            std::minstd_rand rng;
+
+            std::thread thread;
+        };
+
+        Worker* workers;
+        uint32 numWorkers;
+
+        std::atomic<uint32> nextWorker;
+
+        // may dip below zero while a job is taken before submit() counts it
+        std::atomic<int32> numQueuedJobs;
+
+        std::mutex sleepMutex;
+        std::condition_variable jobQueued;
+        std::atomic<bool> running;
+
+        void run_jobs(uint32 workerIndex);
+
+        bool take_job(uint32 workerIndex, Job& job);
+};
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <engine/core/common.hpp>
+
+#if defined(__BMI2__)
+    #include <immintrin.h>
+#endif
+
+// Z-order curve over three axes of up to 6 bits each, which covers every
+// block of a 64^3 chunk. Bits interleave as ...xyzxyz, so every aligned cube
+// of 2^n blocks is a contiguous range of indices and x-major order holds
+// inside each of them. Encoding and decoding use BMI2 pdep/pext when the
+// build targets it (-mbmi2 or -march=native) and small tables otherwise.
+namespace Morton {
+    constexpr const uint32 X_MASK = 0x24924924;
+    constexpr const uint32 Y_MASK = 0x12492492;
+    constexpr const uint32 Z_MASK = 0x09249249;
+
+    struct Tables {
+        // bit i of the key moves to bit 3 * i
+        uint32 spread[64];
+        // 9 interleaved bits unpacked to z in bits 0-2, y 3-5 and x 6-8
+        uint32 compact[512];
+    };
+
+    constexpr Tables makeTables() {
+        Tables tables = {};
+
+        for (uint32 key = 0; key < 64; ++key) {
+            for (uint32 bit = 0; bit < 6; ++bit) {
+                tables.spread[key] |= ((key >> bit) & 1) << (3 * bit);
+            }
+        }
+
+        for (uint32 key = 0; key < 512; ++key) {
+            for (uint32 bit = 0; bit < 3; ++bit) {
+                tables.compact[key] |= ((key >> (3 * bit)) & 1) << bit
+                        | ((key >> (3 * bit + 1)) & 1) << (bit + 3)
+                        | ((key >> (3 * bit + 2)) & 1) << (bit + 6);
+            }
+        }
+
+        return tables;
+    }
+
+    inline constexpr const Tables TABLES = makeTables();
+
+    inline uint32 encode(uint32 x, uint32 y, uint32 z) noexcept {
+#if defined(__BMI2__)
+        return _pdep_u32(x, X_MASK) | _pdep_u32(y, Y_MASK)
+                | _pdep_u32(z, Z_MASK);
+#else
+        return (TABLES.spread[x] << 2) | (TABLES.spread[y] << 1)
+                | TABLES.spread[z];
+#endif
+    }
+
+    inline void decode(uint32 index, uint32& x, uint32& y,
+            uint32& z) noexcept {
+#if defined(__BMI2__)
+        x = _pext_u32(index, X_MASK);
+        y = _pext_u32(index, Y_MASK);
+        z = _pext_u32(index, Z_MASK);
+#else
+        const uint32 low = TABLES.compact[index & 511];
+        const uint32 high = TABLES.compact[(index >> 9) & 511];
+
+        x = (low >> 6) | ((high >> 6) << 3);
+        y = ((low >> 3) & 7) | (((high >> 3) & 7) << 3);
+        z = (low & 7) | ((high & 7) << 3);
+#endif
+    }
+};
@@ -12,6 +12,7 @@
 #include <engine/application/input.hpp>
 
 #include <engine/rendering/render-target.hpp>
+#include <engine/rendering/shader-storage-buffer.hpp>
 
 #include <engine/math/math.hpp>
 #include <engine/math/matrix.hpp>
@@ -20,12 +21,40 @@
 #include "camera-controller.hpp"
 #include "player-input.hpp"
 
+#include "block-registry.hpp"
 #include "chunk-manager.hpp"
 #include "chunk.hpp"
 
+namespace {
+    // in blocks, so every chunk size loads the same part of the world
+    constexpr const int32 VIEW_DISTANCE = 512;
+
+    // region files of edited chunks, only read back by builds with the
+    // same chunk size and block layout
+    constexpr const char* SAVE_DIRECTORY = "./saves/world";
+
+    constexpr const char* BLOCK_TYPES_FILE = "./res/blocks.txt";
+
+    // threads loading and meshing chunks, 0 sizes the pool to the cores
+    constexpr const uint32 NUM_CHUNK_WORKERS = 0;
+};
+
 void MyScene::load() {
+    // before any chunk loads, saved chunks are checked against these types
+    auto& blockRegistry = BlockRegistry::getInstance();
+
+    if (!blockRegistry.load(BLOCK_TYPES_FILE,
+            ChunkBuilder::get_max_block_types())) {
+        // a failed load registers nothing, the world still builds from the
+        // built in types and saved chunks using others are regenerated
+        DEBUG_LOG("MyScene", LOG_WARNING,
+                "Using the %u built in block types without %s",
+                blockRegistry.get_num_types(), BLOCK_TYPES_FILE);
+    }
+
     ResourceCache<Shader>::getInstance().load<ShaderLoader>("basic-shader"_hs,
-        getEngine()->getRenderContext(), "./res/shaders/basic-shader.glsl");
+        getEngine()->getRenderContext(), "./res/shaders/basic-shader.glsl",
+        ChunkBuilder::get_shader_defines());
 
     IndexedModel::AllocationHints hints;
     hints.elementSizes.push_back(3);
@@ -53,10 +82,27 @@ void MyScene::load() {
             0.f, 0.f, 15.f);
     registry.assign<PlayerInputComponent>(eCam);
 
-    chunkManager = new ChunkManager(getEngine()->getRenderContext(), 16);
+    chunkManager = new ChunkManager(getEngine()->getRenderContext(),
+            VIEW_DISTANCE / Chunk::CHUNK_SIZE, SAVE_DIRECTORY,
+            NUM_CHUNK_WORKERS);
 
     cameraBuffer = new UniformBuffer(getEngine()->getRenderContext(),
             sizeof(Matrix4f), GL_STREAM_DRAW, 0);
+
+    // std430 pads vec3 array elements to 16 bytes, the emission goes into
+    // the padding
+    ArrayList<Vector4f> blockColors;
+
+    for (uint32 i = 0; i < blockRegistry.get_num_types(); ++i) {
+        const BlockType type = static_cast<BlockType>(i);
+
+        blockColors.emplace_back(blockRegistry.get_color(type),
+                blockRegistry.get_emission(type));
+    }
+
+    blockColorBuffer = new ShaderStorageBuffer(getEngine()->getRenderContext(),
+            blockColors.size() * sizeof(Vector4f), GL_STATIC_DRAW, 1,
+            blockColors.data());
 }
 
 void MyScene::update(float deltaTime) {
@@ -86,6 +132,39 @@ void MyScene::update(float deltaTime) {
         }
     }
 
+    if (getEngine()->getInput().was_key_pressed(Input::KEY_M)) {
+        constexpr const char* MESHER_NAMES[] = {"mask", "binary", "validate"};
+
+        const int32 next = (static_cast<int32>(chunkManager->get_mesher_type())
+                + 1) % static_cast<int32>(MesherType::NUM_TYPES);
+
+        chunkManager->set_mesher_type(static_cast<MesherType>(next));
+        DEBUG_LOG("MyScene", LOG_INFO, "Mesher: %s", MESHER_NAMES[next]);
+    }
+
+    if (getEngine()->getInput().was_key_pressed(Input::KEY_T)) {
+        uint64 numQuads, numPlainQuads;
+        chunkManager->get_ao_quad_counts(numQuads, numPlainQuads);
+
+        DEBUG_LOG("MyScene", LOG_INFO, "Triangles: %u",
+                chunkManager->get_num_triangles());
+        DEBUG_LOG("MyScene", LOG_INFO,
+                "Validated quads: %llu with AO, %llu without",
+                (unsigned long long)numQuads,
+                (unsigned long long)numPlainQuads);
+        DEBUG_LOG("MyScene", LOG_INFO, "Mesh allocations: %llu",
+                (unsigned long long)chunkManager->get_num_mesh_allocations());
+
+        double lastLatency, averageLatency;
+        chunkManager->get_edit_latency(lastLatency, averageLatency);
+
+        DEBUG_LOG("MyScene", LOG_INFO, "Uploaded %llu bytes",
+                (unsigned long long)chunkManager->get_num_uploaded_bytes());
+        DEBUG_LOG("MyScene", LOG_INFO,
+                "Edit latency: %.2f ms last, %.2f ms average",
+                lastLatency * 1000.0, averageLatency * 1000.0);
+    }
+
     chunkManager->update(*cam);
 
     update_block_placement();
@@ -105,6 +184,7 @@ void MyScene::render() {
 }
 
 void MyScene::unload() {
+    delete blockColorBuffer;
     delete cameraBuffer;
     delete chunkManager;
     delete screen;
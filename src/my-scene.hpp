@@ -5,6 +5,7 @@
 class RenderTarget;
 class ChunkManager;
 class UniformBuffer;
+class ShaderStorageBuffer;
 
 class MyScene final : public Scene<MyScene> {
     public:
@@ -20,6 +21,7 @@ class MyScene final : public Scene<MyScene> {
         RenderTarget* screen;
         ChunkManager* chunkManager;
         UniformBuffer* cameraBuffer;
+        ShaderStorageBuffer* blockColorBuffer;
 
         void update_block_placement();
 };
@@ -0,0 +1,371 @@
+#include "region-store.hpp"
+
+#include <engine/core/memory.hpp>
+
+#include <filesystem>
+#include <system_error>
+
+#if defined(OPERATING_SYSTEM_LINUX)
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+    #include <unistd.h>
+#endif
+
+#include "chunk.hpp"
+
+namespace {
+    constexpr const uint32 REGION_MAGIC = 0x47525856; // "VXRG"
+    constexpr const uint32 REGION_VERSION = 2;
+
+#ifdef VOXEL_MORTON_BLOCKS
+    constexpr const uint32 BLOCK_LAYOUT = 1;
+#else
+    constexpr const uint32 BLOCK_LAYOUT = 0;
+#endif
+
+    // chunk data only reads back into chunks of the same size and block
+    // layout, files written by other builds are left alone
+    struct RegionHeader {
+        uint32 magic;
+        uint32 version;
+        uint32 chunkSize;
+        uint32 blockLayout;
+    };
+
+    constexpr const RegionHeader HEADER = {REGION_MAGIC, REGION_VERSION,
+            Chunk::CHUNK_SIZE, BLOCK_LAYOUT};
+
+    // 21 bits per axis
+    uint64 get_chunk_key(const Vector3i& position) {
+        constexpr const uint64 MASK = (uint64(1) << 21) - 1;
+
+        return ((static_cast<uint64>(position.x) & MASK) << 42)
+                | ((static_cast<uint64>(position.y) & MASK) << 21)
+                | (static_cast<uint64>(position.z) & MASK);
+    }
+
+    // the shift rounds negative positions down to the region holding them
+    Vector3i get_region_position(const Vector3i& chunkPos) {
+        return Vector3i(chunkPos.x >> RegionStore::REGION_SIZE_SHIFT,
+                chunkPos.y >> RegionStore::REGION_SIZE_SHIFT,
+                chunkPos.z >> RegionStore::REGION_SIZE_SHIFT);
+    }
+
+    uint32 get_slot_index(const Vector3i& chunkPos) {
+        constexpr const int32 MASK = RegionStore::REGION_SIZE - 1;
+        constexpr const int32 SHIFT = RegionStore::REGION_SIZE_SHIFT;
+
+        return ((chunkPos.x & MASK) << (2 * SHIFT))
+                | ((chunkPos.y & MASK) << SHIFT) | (chunkPos.z & MASK);
+    }
+
+    String get_file_name(const String& directory, const Vector3i& regionPos) {
+        return directory + "/r." + std::to_string(regionPos.x) + "."
+                + std::to_string(regionPos.y) + "."
+                + std::to_string(regionPos.z) + ".bin";
+    }
+};
+
+RegionStore::RegionStore(const String& directory)
+        : directory(directory)
+        , writing(false)
+        , running(true)
+        , writeThread([this]() { write_chunks(); }) {}
+
+void RegionStore::save_chunk(const Vector3i& position,
+        ArrayList<uint8>&& data) {
+    std::unique_lock<std::mutex> lock(writeMutex);
+
+    PendingWrite& write = pendingWrites[get_chunk_key(position)];
+    write.position = position;
+    write.data = std::move(data);
+
+    lock.unlock();
+
+    writeQueued.notify_one();
+}
+
+void RegionStore::prefetch_chunks(const ArrayList<Vector3i>& positions) {
+#if defined(OPERATING_SYSTEM_LINUX)
+    // called from the main thread, which must not wait out a write batch
+    std::unique_lock<std::mutex> lock(regionMutex, std::try_to_lock);
+
+    if (!lock.owns_lock()) {
+        return;
+    }
+
+    const uintptr pageMask = static_cast<uintptr>(sysconf(_SC_PAGESIZE)) - 1;
+
+    for (const Vector3i& position : positions) {
+        Region* region = get_region(get_region_position(position), false);
+
+        if (!region->file) {
+            continue;
+        }
+
+        const ChunkSlot& slot = region->slots[get_slot_index(position)];
+
+        if (slot.size == 0) {
+            continue;
+        }
+
+        if (const uint8* data = read_slot(*region, slot); data) {
+            const uintptr begin = reinterpret_cast<uintptr>(data) & ~pageMask;
+            const uintptr end = reinterpret_cast<uintptr>(data) + slot.size;
+
+            madvise(reinterpret_cast<void*>(begin), end - begin,
+                    MADV_WILLNEED);
+        }
+    }
+#endif
+}
+
+void RegionStore::flush() {
+    std::unique_lock<std::mutex> lock(writeMutex);
+
+    writeFinished.wait(lock, [this]() {
+        return pendingWrites.empty() && !writing;
+    });
+}
+
+RegionStore::~RegionStore() {
+    std::unique_lock<std::mutex> lock(writeMutex);
+    running = false;
+    lock.unlock();
+
+    // the writer drains the queue before it exits
+    writeQueued.notify_all();
+    writeThread.join();
+
+    for (auto& [key, region] : regions) {
+        unmap_region(*region);
+
+        if (region->file) {
+            std::fclose(region->file);
+        }
+
+        delete region;
+    }
+}
+
+void RegionStore::write_chunks() {
+    std::unique_lock<std::mutex> lock(writeMutex);
+
+    while (true) {
+        writeQueued.wait(lock, [this]() {
+            return !pendingWrites.empty() || !running;
+        });
+
+        if (pendingWrites.empty()) {
+            break;
+        }
+
+        HashMap<uint64, PendingWrite> batch;
+        batch.swap(pendingWrites);
+
+        writing = true;
+
+        std::unique_lock<std::mutex> regionLock(regionMutex);
+        lock.unlock();
+
+        for (auto& [key, write] : batch) {
+            write_chunk(write.position, write.data);
+        }
+
+        for (auto& [key, region] : regions) {
+            if (region->file) {
+                std::fflush(region->file);
+            }
+        }
+
+        regionLock.unlock();
+        lock.lock();
+
+        writing = false;
+        writeFinished.notify_all();
+    }
+}
+
+void RegionStore::write_chunk(const Vector3i& position,
+        const ArrayList<uint8>& data) {
+    Region* region = get_region(get_region_position(position), true);
+
+    if (!region->file) {
+        return;
+    }
+
+    const uint32 slotIndex = get_slot_index(position);
+    ChunkSlot& slot = region->slots[slotIndex];
+
+    // the old slot is abandoned when the data outgrew it
+    if (data.size() > slot.capacity) {
+        slot.offset = region->fileSize;
+        slot.capacity = static_cast<uint32>(data.size());
+
+        region->fileSize += slot.capacity;
+    }
+
+    slot.size = static_cast<uint32>(data.size());
+
+    const long slotOffset = sizeof(RegionHeader)
+            + slotIndex * sizeof(ChunkSlot);
+
+    if (std::fseek(region->file, slot.offset, SEEK_SET) != 0
+            || std::fwrite(data.data(), data.size(), 1, region->file) != 1
+            || std::fseek(region->file, slotOffset, SEEK_SET) != 0
+            || std::fwrite(&slot, sizeof(slot), 1, region->file) != 1) {
+        DEBUG_LOG("RegionStore", LOG_ERROR,
+                "Failed to save chunk (%d, %d, %d)", position.x, position.y,
+                position.z);
+    }
+}
+
+RegionStore::Region* RegionStore::get_region(const Vector3i& regionPos,
+        bool create) {
+    Region*& region = regions[get_chunk_key(regionPos)];
+
+    if (!region) {
+        const String fileName = get_file_name(directory, regionPos);
+
+        region = new Region();
+        region->file = std::fopen(fileName.c_str(), "r+b");
+
+        if (region->file) {
+            RegionHeader header;
+
+            if (std::fread(&header, sizeof(header), 1, region->file) != 1
+                    || Memory::memcmp(&header, &HEADER, sizeof(header)) != 0
+                    || std::fread(region->slots, sizeof(region->slots), 1,
+                            region->file) != 1
+                    || std::fseek(region->file, 0, SEEK_END) != 0) {
+                DEBUG_LOG("RegionStore", LOG_WARNING,
+                        "Ignoring region file %s written by another build",
+                        fileName.c_str());
+
+                std::fclose(region->file);
+                region->file = nullptr;
+                region->foreign = true;
+
+                Memory::memset(region->slots, 0, sizeof(region->slots));
+            }
+            else {
+                region->fileSize = static_cast<uint32>(
+                        std::ftell(region->file));
+            }
+        }
+    }
+
+    if (region->file || region->foreign || !create) {
+        return region;
+    }
+
+    std::error_code error;
+    std::filesystem::create_directories(directory.c_str(), error);
+
+    const String fileName = get_file_name(directory, regionPos);
+    region->file = std::fopen(fileName.c_str(), "w+b");
+
+    if (!region->file) {
+        DEBUG_LOG("RegionStore", LOG_ERROR, "Failed to create region file %s",
+                fileName.c_str());
+
+        return region;
+    }
+
+    region->fileSize = sizeof(RegionHeader) + sizeof(region->slots);
+
+    std::fwrite(&HEADER, sizeof(HEADER), 1, region->file);
+    std::fwrite(region->slots, sizeof(region->slots), 1, region->file);
+
+    return region;
+}
+
+const uint8* RegionStore::find_chunk(const Vector3i& position, size_t& size,
+        std::unique_lock<std::mutex>& lock) {
+    std::unique_lock<std::mutex> writeLock(writeMutex);
+
+    if (auto it = pendingWrites.find(get_chunk_key(position));
+            it != std::end(pendingWrites)) {
+        size = it->second.data.size();
+        lock = std::move(writeLock);
+
+        return it->second.data.data();
+    }
+
+    // taken before the queue is let go, so a batch the writer has just
+    // taken out of it is on disk by the time the file is read
+    std::unique_lock<std::mutex> regionLock(regionMutex);
+    writeLock.unlock();
+
+    Region* region = get_region(get_region_position(position), false);
+
+    if (!region->file) {
+        return nullptr;
+    }
+
+    const ChunkSlot& slot = region->slots[get_slot_index(position)];
+
+    if (slot.size == 0) {
+        return nullptr;
+    }
+
+    const uint8* data = read_slot(*region, slot);
+
+    if (data) {
+        size = slot.size;
+        lock = std::move(regionLock);
+    }
+
+    return data;
+}
+
+const uint8* RegionStore::read_slot(Region& region, const ChunkSlot& slot) {
+#if defined(OPERATING_SYSTEM_LINUX)
+    const size_t end = static_cast<size_t>(slot.offset) + slot.size;
+
+    if (end > region.mappingSize) {
+        unmap_region(region);
+
+        const int fd = fileno(region.file);
+        struct stat fileStat;
+
+        // maps what is really on disk, a short file must not fault later
+        if (fstat(fd, &fileStat) != 0
+                || static_cast<size_t>(fileStat.st_size) < end) {
+            return nullptr;
+        }
+
+        void* mapping = mmap(nullptr, fileStat.st_size, PROT_READ,
+                MAP_SHARED, fd, 0);
+
+        if (mapping == MAP_FAILED) {
+            return nullptr;
+        }
+
+        region.mapping = static_cast<const uint8*>(mapping);
+        region.mappingSize = fileStat.st_size;
+    }
+
+    return region.mapping + slot.offset;
+#else
+    readBuffer.resize(slot.size);
+
+    if (std::fseek(region.file, slot.offset, SEEK_SET) != 0
+            || std::fread(readBuffer.data(), slot.size, 1, region.file) != 1) {
+        return nullptr;
+    }
+
+    return readBuffer.data();
+#endif
+}
+
+void RegionStore::unmap_region(Region& region) {
+#if defined(OPERATING_SYSTEM_LINUX)
+    if (region.mapping) {
+        munmap(const_cast<uint8*>(region.mapping), region.mappingSize);
+
+        region.mapping = nullptr;
+        region.mappingSize = 0;
+    }
+#endif
+}
@@ -0,0 +1,126 @@
+#pragma once
+
+#include <engine/core/common.hpp>
+#include <engine/core/array-list.hpp>
+#include <engine/core/hash-map.hpp>
+#include <engine/core/string.hpp>
+
+#include <engine/math/vector.hpp>
+
+#include <condition_variable>
+#include <cstdio>
+#include <mutex>
+#include <thread>
+
+// Keeps the blocks of edited chunks on disk once they stream out, so they
+// come back the way they were left instead of being generated again.
+// Chunks are grouped into region files of REGION_SIZE^3 chunks, each of which
+// starts with a table of where the data of every chunk lies in the file.
+// Rewriting a chunk reuses its old slot when the new data still fits and
+// appends to the file otherwise.
+//
+// save_chunk() only queues the data for a background thread that does the
+// writes. Reads look at that queue first, so a chunk that streams back in
+// before it reached the disk still loads its latest copy. Region files are
+// read through a read only mapping where the OS supports it, so chunk data
+// goes from the page cache straight into the block storage.
+class RegionStore {
+    public:
+        static constexpr const int32 REGION_SIZE_SHIFT = 4;
+        static constexpr const int32 REGION_SIZE = 1 << REGION_SIZE_SHIFT;
+        static constexpr const int32 NUM_REGION_CHUNKS
+                = REGION_SIZE * REGION_SIZE * REGION_SIZE;
+
+        // region files go into directory, which is created on the first save
+        explicit RegionStore(const String& directory);
+
+        void save_chunk(const Vector3i& position, ArrayList<uint8>&& data);
+        // calls func(data, size) with the saved data of the chunk, which is
+        // only valid during the call. Returns false when the chunk was never
+        // saved and what func returned otherwise
+        template <typename Func>
+        bool load_chunk(const Vector3i& position, Func&& func);
+
+        // asks the OS to start reading the saved chunks among positions in
+        // the background, skipped while the writer holds the files
+        void prefetch_chunks(const ArrayList<Vector3i>& positions);
+
+        // blocks until every queued chunk has been written
+        void flush();
+
+        ~RegionStore();
+    private:
+        NULL_COPY_AND_ASSIGN(RegionStore);
+
+        struct ChunkSlot {
+            uint32 offset;
+            uint32 size;
+            uint32 capacity;
+        };
+
+        struct Region {
+            // null when there is no file yet or it was written by another
+            // build, which is never read or overwritten
+            FILE* file;
+            bool foreign;
+            uint32 fileSize;
+            ChunkSlot slots[NUM_REGION_CHUNKS];
+
+            // mapped up to the end of the file when it was last mapped,
+            // grown again once a slot lies past it
+            const uint8* mapping;
+            size_t mappingSize;
+        };
+
+        struct PendingWrite {
+            Vector3i position;
+            ArrayList<uint8> data;
+        };
+
+        String directory;
+
+        // regions are opened on first use and stay open, regionMutex also
+        // covers every file access
+        HashMap<uint64, Region*> regions;
+        std::mutex regionMutex;
+
+        // latest data per chunk not written yet, a newer save of the same
+        // chunk replaces the older one
+        HashMap<uint64, PendingWrite> pendingWrites;
+        std::mutex writeMutex;
+        std::condition_variable writeQueued;
+        std::condition_variable writeFinished;
+        bool writing;
+        bool running;
+
+        std::thread writeThread;
+
+        // holds chunks read without a mapping, guarded by regionMutex
+        ArrayList<uint8> readBuffer;
+
+        void write_chunks();
+        // expects regionMutex to be held
+        void write_chunk(const Vector3i& position, const ArrayList<uint8>& data);
+
+        // expects regionMutex to be held, opens the file on first use and
+        // only creates it when create is set
+        Region* get_region(const Vector3i& regionPos, bool create);
+
+        // returns the saved data of a chunk and the lock that keeps it valid,
+        // null when there is none
+        const uint8* find_chunk(const Vector3i& position, size_t& size,
+                std::unique_lock<std::mutex>& lock);
+        // expects regionMutex to be held
+        const uint8* read_slot(Region& region, const ChunkSlot& slot);
+        void unmap_region(Region& region);
+};
+
+template <typename Func>
+inline bool RegionStore::load_chunk(const Vector3i& position, Func&& func) {
+    std::unique_lock<std::mutex> lock;
+    size_t size;
+
+    const uint8* data = find_chunk(position, size, lock);
+
+    return data && func(data, size);
+}